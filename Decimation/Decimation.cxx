@@ -5,102 +5,684 @@
 #include "vtkNew.h"
 #include "vtkOBJReader.h"
 #include "vtkOBJWriter.h"
+#include "vtkPLYReader.h"
+#include "vtkPLYWriter.h"
 #include "vtkPolyData.h"
 #include "vtkQuadricDecimation.h"
 #include "vtkSmartPointer.h"
+#include "vtkSTLReader.h"
+#include "vtkSTLWriter.h"
 #include "vtkTriangleFilter.h"
 #include "vtkXMLPolyDataWriter.h"
 #include "vtkXMLPolyDataReader.h"
+#include <vtksys/Glob.hxx>
 #include <vtksys/SystemTools.hxx>
 
-#include "Simplify.h" // FastQuadric method
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
 
-int main(int argc, char* argv[])
+// Peak memory
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "FastQuadricMetrics.h" // quality report
+#include "FastQuadricPolyData.h" // FastQuadric method
+#include "FastQuadricProgressive.h" // progressive model output
+#include "FastQuadricStreaming.h" // FastQuadric method with memory budget
+
+namespace
 {
-  PARSE_ARGS;
 
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkPolyData> ReadPolyData(const std::string& fileName, const std::string& ext, std::ostream& err)
+{
+  vtkSmartPointer<vtkPolyData> polyData;
+  if (ext == ".obj")
+    {
+    vtkNew<vtkOBJReader> reader;
+    reader->SetFileName(fileName.c_str());
+    reader->Update();
+    polyData = reader->GetOutput();
+    }
+  else if (ext == ".vtp")
+    {
+    vtkNew<vtkXMLPolyDataReader> reader;
+    reader->SetFileName(fileName.c_str());
+    reader->Update();
+    polyData = reader->GetOutput();
+    }
+  else if (ext == ".stl")
+    {
+    vtkNew<vtkSTLReader> reader;
+    reader->SetFileName(fileName.c_str());
+    reader->Update();
+    polyData = reader->GetOutput();
+    }
+  else if (ext == ".ply")
+    {
+    vtkNew<vtkPLYReader> reader;
+    reader->SetFileName(fileName.c_str());
+    reader->Update();
+    polyData = reader->GetOutput();
+    }
+  else
+    {
+    err << "Input mesh is expected in OBJ, VTP, STL, or PLY file format." << std::endl;
+    return nullptr;
+    }
+  if (!polyData || !polyData->GetPoints() || polyData->GetNumberOfPoints() == 0)
+    {
+    err << "Failed to read input model: " << fileName << std::endl;
+    return nullptr;
+    }
+  return polyData;
+}
+
+//----------------------------------------------------------------------------
+bool WritePolyData(vtkPolyData* polyData, const std::string& fileName, const std::string& ext, std::ostream& err)
+{
+  int success = 0;
+  if (ext == ".obj")
+    {
+    vtkNew<vtkOBJWriter> writer;
+    writer->SetFileName(fileName.c_str());
+    writer->SetInputData(polyData);
+    success = writer->Write();
+    }
+  else if (ext == ".vtp")
+    {
+    vtkNew<vtkXMLPolyDataWriter> writer;
+    writer->SetFileName(fileName.c_str());
+    writer->SetInputData(polyData);
+    // raw (not base64 encoded) compressed binary data
+    writer->SetDataModeToAppended();
+    writer->EncodeAppendedDataOff();
+    writer->SetCompressorTypeToZLib();
+    success = writer->Write();
+    }
+  else if (ext == ".stl")
+    {
+    vtkNew<vtkSTLWriter> writer;
+    writer->SetFileName(fileName.c_str());
+    writer->SetInputData(polyData);
+    writer->SetFileTypeToBinary();
+    success = writer->Write();
+    }
+  else if (ext == ".ply")
+    {
+    vtkNew<vtkPLYWriter> writer;
+    writer->SetFileName(fileName.c_str());
+    writer->SetInputData(polyData);
+    writer->SetFileTypeToBinary();
+    success = writer->Write();
+    }
+  else
+    {
+    err << "Output mesh can be written in OBJ, VTP, STL, or PLY file format." << std::endl;
+    return false;
+    }
+  if (!success)
+    {
+    err << "Failed to write output model: " << fileName << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkPolyData> Triangulate(vtkPolyData* polyData)
+{
+  if (FastQuadricIsTriangleMesh(polyData))
+    {
+    // already triangulated, avoid a copy of the mesh
+    return polyData;
+    }
+  vtkNew<vtkTriangleFilter> triangles;
+  triangles->SetInputData(polyData);
+  triangles->Update();
+  return triangles->GetOutput();
+}
+
+//----------------------------------------------------------------------------
+// Write the mesh of a FastQuadric simplifier. OBJ files are written by the
+// simplifier, other formats by VTK with the point data of the input.
+bool WriteModel(FastQuadricSimplifier& simplifier, vtkPolyData* inputPolyData,
+  const std::string& fileName, const std::string& ext, std::ostream& err)
+{
+  if (ext == ".obj")
+    {
+    if (!simplifier.write_obj(fileName.c_str()))
+      {
+      err << "Failed to write output model: " << fileName << std::endl;
+      return false;
+      }
+    return true;
+    }
+  return WritePolyData(FastQuadricExportPolyData(simplifier, inputPolyData), fileName, ext, err);
+}
+
+//----------------------------------------------------------------------------
+// Progress of FastQuadric methods. When the module runs in Slicer's process
+// it is reported through the process information structure (which also
+// tells if the user cancelled), otherwise as <filter-progress> elements on
+// the standard output. Progress of consecutive stages (pre-clustering and
+// decimation) is mapped to [StageStart, StageEnd].
+struct ProgressReporter
+  {
+  ModuleProcessInformation* ProcessInformation = nullptr;
+  double StageStart = 0.0;
+  double StageEnd = 1.0;
+  double LastProgress = -1.0;
+
+  void Start(const std::string& comment)
+    {
+    if (!this->ProcessInformation)
+      {
+      std::cout << "<filter-start>" << std::endl
+        << "<filter-name>Decimation</filter-name>" << std::endl
+        << "<filter-comment>" << comment << "</filter-comment>" << std::endl
+        << "</filter-start>" << std::endl;
+      }
+    }
+
+  void End(double elapsedTime)
+    {
+    if (!this->ProcessInformation)
+      {
+      std::cout << "<filter-end>" << std::endl
+        << "<filter-name>Decimation</filter-name>" << std::endl
+        << "<filter-time>" << elapsedTime << "</filter-time>" << std::endl
+        << "</filter-end>" << std::endl;
+      }
+    }
+
+  // Returns false if the user requested cancellation
+  bool Report(const FastQuadricSimplifier::Progress& progress)
+    {
+    char message[256];
+    snprintf(message, sizeof(message), "Iteration %d, %d triangles, threshold %g",
+      progress.iteration, progress.triangles, progress.threshold);
+    return this->Report(progress.fraction, message);
+    }
+
+  bool Report(double fraction, const char* message)
+    {
+    fraction = std::min(std::max(fraction, 0.0), 1.0);
+    fraction = this->StageStart + (this->StageEnd - this->StageStart) * fraction;
+    if (this->ProcessInformation)
+      {
+      this->ProcessInformation->Progress = fraction;
+      snprintf(this->ProcessInformation->ProgressMessage, sizeof(this->ProcessInformation->ProgressMessage), "%s", message);
+      if (this->ProcessInformation->ProgressCallbackFunction && this->ProcessInformation->ProgressCallbackClientData)
+        {
+        (*(this->ProcessInformation->ProgressCallbackFunction))(this->ProcessInformation->ProgressCallbackClientData);
+        }
+      return !this->ProcessInformation->Abort;
+      }
+    // limit the output to percent steps
+    if (fraction >= this->LastProgress + 0.01)
+      {
+      std::cout << "<filter-progress>" << fraction << "</filter-progress>" << std::endl;
+      this->LastProgress = fraction;
+      }
+    return true;
+    }
+  };
+
+//----------------------------------------------------------------------------
+// Parameters of the decimation that are the same for all models
+struct DecimationSettings
+  {
+  std::string Method;
+  double MaxError = 0.0;
+  std::vector<float> LodReductionFactors;
+  std::string ProgressiveModel;
+  bool BoundaryDeletion = true;
+  double BoundaryWeight = 0.0;
+  double FeatureAngle = 0.0;
+  double FeatureWeight = 1000.0;
+  bool Lossless = false;
+  bool VolumePreservation = false;
+  double Aggressiveness = 7.0;
+  int PreCluster = 0;
+  int Threads = 1;
+  bool Deterministic = true;
+  int MemoryBudget = 0;
+  bool MeasureError = false;
+  bool Verbose = false;
+  };
+
+//----------------------------------------------------------------------------
+// Outcome of decimating one model (times in seconds)
+struct DecimationResult
+  {
+  size_t InputTriangles = 0;
+  size_t OutputTriangles = 0;
+  double AchievedError = 0.0;
+  double ReadTime = 0.0;
+  double TriangulateTime = 0.0;
+  double DecimationTime = 0.0;
+  double WriteTime = 0.0;
+  // Distance of the input vertices to the output surface (-1 if not measured)
+  double HausdorffDistance = -1.0;
+  double MeanDistance = -1.0;
+  // Output triangle shape (see FastQuadricMetrics.h for the bins)
+  std::vector<int> AspectRatioHistogram;
+  std::vector<int> MinAngleHistogram;
+  bool Cancelled = false;
+  };
+
+//----------------------------------------------------------------------------
+double SecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+//----------------------------------------------------------------------------
+// Peak resident memory of the process in MB (0 if not available)
+double PeakMemory()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+    return 0.0;
+    }
+  return counters.PeakWorkingSetSize / 1048576.0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+    return 0.0;
+    }
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1048576.0; // bytes
+#else
+  return usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Measure the output mesh, the distances only if the input was set
+void MeasureOutput(FastQuadricMeshMetrics& metrics, std::ostream& out, DecimationResult& result)
+{
+  result.HausdorffDistance = metrics.hausdorff_distance;
+  result.MeanDistance = metrics.mean_distance;
+  result.AspectRatioHistogram = metrics.aspect_ratio_histogram;
+  result.MinAngleHistogram = metrics.min_angle_histogram;
+  if (metrics.has_input())
+    {
+    out << "Distance of input to output surface: maximum " << result.HausdorffDistance
+      << ", mean " << result.MeanDistance << std::endl;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Decimate a model with a FastQuadric method or Clustering. Messages are
+// written to out, errors to err. Progress is reported if progress is set.
+bool DecimateFastQuadric(const DecimationSettings& settings, const std::string& inputModel, const std::string& outputModel,
+  double reductionFactor, ProgressReporter* progress, std::ostream& out, std::ostream& err, DecimationResult& result)
+{
+  const std::string& method = settings.Method;
   std::string inputModelExt = vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(inputModel));
   std::string outputModelExt = vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(outputModel));
+  bool verbose = settings.Verbose;
+  int preCluster = settings.PreCluster;
 
-  if (method == "FastQuadric")
+  // OBJ files are parsed by the simplifier (keeping materials and texture
+  // coordinates), other formats are read by VTK and copied into its arrays
+  // (keeping point data arrays)
+  FastQuadricStreamingSimplifier simplifier;
+  simplifier.threads = settings.Threads;
+  simplifier.deterministic = settings.Deterministic;
+  simplifier.lock_border = !settings.BoundaryDeletion;
+  simplifier.border_weight = settings.BoundaryWeight;
+  simplifier.feature_angle = settings.FeatureAngle;
+  simplifier.feature_weight = settings.FeatureWeight;
+  simplifier.max_error = settings.MaxError;
+  simplifier.volume_preservation = settings.VolumePreservation;
+  if (progress)
+    {
+    simplifier.progress_callback = [progress](const FastQuadricSimplifier::Progress& p) { return progress->Report(p); };
+    }
+  vtkSmartPointer<vtkPolyData> inputPolyData;
+  size_t startSize = 0;
+  FastQuadricMeshMetrics metrics;
+  metrics.threads = settings.Threads;
+  bool streaming = (settings.MemoryBudget > 0 && inputModelExt == ".obj" && !settings.Lossless && method != "Clustering");
+  if (settings.MemoryBudget > 0 && !streaming)
+    {
+    err << "Memory budget is ignored, it is only used for OBJ input and FastQuadric methods without lossless decimation." << std::endl;
+    }
+  if (streaming)
     {
-    if (inputModelExt != ".obj" || outputModelExt != ".obj")
+    // The mesh is decimated while it is read, decimation time includes reading
+    if (!settings.LodReductionFactors.empty() || !settings.ProgressiveModel.empty())
       {
-      std::cerr << "FastQuadric method only supports input/output mesh files in OBJ format." << std::endl;
-      return EXIT_FAILURE;
+      err << "Levels of detail and progressive model are ignored when a memory budget is used." << std::endl;
       }
-    Simplify::load_obj(inputModel.c_str());
-    if ((Simplify::triangles.size() < 3) || (Simplify::vertices.size() < 3))
+    if (settings.MeasureError)
       {
-      std::cerr << "Minimum 3 triangles are needed." << std::endl;
-      return EXIT_FAILURE;
+      err << "Distance to the input is not measured when a memory budget is used." << std::endl;
       }
-    int target_count = round((float)Simplify::triangles.size() * (1.0-reductionFactor));
-    if (target_count < 4)
+    if (preCluster > 0)
       {
-      std::cerr << "Object will not survive such extreme decimation." << std::endl;
-      return EXIT_FAILURE;
+      err << "Pre-clustering is ignored when a memory budget is used." << std::endl;
       }
-    std::cout << "Input: " << Simplify::vertices.size() << " vertices,"
-      << Simplify::triangles.size() << " triangles (target " << target_count << ")" << std::endl;
-    size_t startSize = Simplify::triangles.size();
-    if (lossless)
+    simplifier.memory_budget = size_t(settings.MemoryBudget) << 20;
+    auto startTime = std::chrono::steady_clock::now();
+    if (progress)
       {
-      Simplify::simplify_mesh_lossless(verbose);
+      progress->Start(method + " decimation with memory budget");
       }
-    else
+    FastQuadricStreamingSimplifier::Engine engine = FastQuadricStreamingSimplifier::SWEEP;
+    if (method == "FastQuadricHeap")
       {
-      Simplify::simplify_mesh(target_count, aggressiveness, verbose);
+      engine = FastQuadricStreamingSimplifier::HEAP;
       }
-    if (Simplify::triangles.size() >= startSize)
+    else if (method == "ParallelQuadric")
       {
-      std::cerr << "Unable to reduce mesh." << std::endl;
-      return EXIT_FAILURE;
+      engine = FastQuadricStreamingSimplifier::PARALLEL_HEAP;
       }
-    Simplify::write_obj(outputModel.c_str());
-    double achievedReduction = 1.0 - (double)Simplify::triangles.size() / (double)startSize;
-    std::cout << "Output: " << Simplify::vertices.size() << " vertices,"
-      << Simplify::triangles.size() << " triangles (" << achievedReduction << " reduction)" << std::endl;
-    return EXIT_SUCCESS;
+    if (!simplifier.simplify_obj(inputModel.c_str(), reductionFactor, settings.Aggressiveness, engine, verbose))
+      {
+      if (simplifier.aborted)
+        {
+        err << "Decimation cancelled." << std::endl;
+        result.Cancelled = true;
+        }
+      else
+        {
+        err << "Failed to decimate input model: " << inputModel << std::endl;
+        }
+      return false;
+      }
+    result.DecimationTime = SecondsSince(startTime);
+    startSize = simplifier.input_triangle_count;
+    out << "Input: " << startSize << " triangles (memory budget " << settings.MemoryBudget << " MB)" << std::endl;
     }
+  else
+    {
+    auto readStartTime = std::chrono::steady_clock::now();
+    if (inputModelExt == ".obj")
+      {
+      if (!simplifier.load_obj(inputModel.c_str()))
+        {
+        err << "Failed to read input model: " << inputModel << std::endl;
+        return false;
+        }
+      }
+    else
+      {
+      inputPolyData = ReadPolyData(inputModel, inputModelExt, err);
+      if (!inputPolyData)
+        {
+        return false;
+        }
+      auto triangulateStartTime = std::chrono::steady_clock::now();
+      inputPolyData = Triangulate(inputPolyData);
+      result.TriangulateTime = SecondsSince(triangulateStartTime);
+      FastQuadricImportPolyData(inputPolyData, simplifier);
+      }
+    result.ReadTime = SecondsSince(readStartTime) - result.TriangulateTime;
+    if ((simplifier.triangles.size() < 3) || (simplifier.vertices.size() < 3))
+      {
+      err << "Minimum 3 triangles are needed." << std::endl;
+      return false;
+      }
+    int target_count = round((float)simplifier.triangles.size() * (1.0-reductionFactor));
+    if (target_count < 4 && settings.MaxError > 0)
+      {
+      // the error bound stops the decimation
+      target_count = 4;
+      }
+    if (target_count < 4)
+      {
+      err << "Object will not survive such extreme decimation." << std::endl;
+      return false;
+      }
+    out << "Input: " << simplifier.vertices.size() << " vertices,"
+      << simplifier.triangles.size() << " triangles (target " << target_count << ")" << std::endl;
+    startSize = simplifier.triangles.size();
+    if (settings.MeasureError)
+      {
+      metrics.set_input(simplifier);
+      }
 
-  // VTK decimation filters
+    // The progressive model is built from the edge collapses of all
+    // decimation runs, which do not exist for clustering
+    FastQuadricProgressiveMesh progressiveMesh;
+    bool progressive = !settings.ProgressiveModel.empty();
+    bool progressiveValid = true;
+    if (progressive && method == "Clustering")
+      {
+      err << "Progressive model is not written, it is not supported by Clustering method." << std::endl;
+      progressive = false;
+      }
+    if (progressive && preCluster > 0)
+      {
+      err << "Pre-clustering is ignored when a progressive model is written." << std::endl;
+      preCluster = 0;
+      }
+    if (progressive)
+      {
+      simplifier.record_collapses = true;
+      simplifier.track_vertex_origin = true;
+      progressiveMesh.set_original(simplifier);
+      }
 
-  // Read the input model
-  vtkSmartPointer<vtkPolyData> inputPolyData;
-  if (inputModelExt == ".obj")
+    auto startTime = std::chrono::steady_clock::now();
+    if (progress)
+      {
+      progress->Start(method + " decimation");
+      }
+
+    // Decimate the current mesh to the target, the progress bar shows the
+    // progress towards the final target
+    double achievedError = 0;
+    auto decimate = [&](int target)
+      {
+      double range = std::max((double)startSize - target_count, 1.0);
+      double stageStart = std::min((startSize - simplifier.triangles.size()) / range, 1.0);
+      double stageEnd = std::min((startSize - target) / range, 1.0);
+      if (progress)
+        {
+        progress->StageStart = stageStart;
+        progress->StageEnd = stageEnd;
+        }
+      if (method == "Clustering")
+        {
+        simplifier.simplify_mesh_clustering(target, verbose);
+        }
+      else if (settings.Lossless)
+        {
+        simplifier.simplify_mesh_lossless(verbose);
+        }
+      else
+        {
+        if (preCluster > target && (size_t)preCluster < simplifier.triangles.size())
+          {
+          // fast first reduction of very large meshes
+          if (progress)
+            {
+            progress->StageEnd = stageStart + 0.2 * (stageEnd - stageStart);
+            }
+          simplifier.simplify_mesh_clustering(preCluster, verbose);
+          if (progress)
+            {
+            progress->StageStart = progress->StageEnd;
+            progress->StageEnd = stageEnd;
+            }
+          achievedError = std::max(achievedError, simplifier.collapse_error);
+          out << "Pre-clustering: " << simplifier.triangles.size() << " triangles" << std::endl;
+          }
+        if (method == "FastQuadricHeap")
+          {
+          simplifier.simplify_mesh_heap(target, verbose);
+          }
+        else if (method == "ParallelQuadric")
+          {
+          simplifier.simplify_mesh_heap_parallel(target, verbose);
+          }
+        else
+          {
+          simplifier.simplify_mesh(target, settings.Aggressiveness, verbose);
+          }
+        }
+      achievedError = std::max(achievedError, simplifier.collapse_error);
+      simplifier.collapse_error = achievedError;
+      if (progressive && !simplifier.aborted && !progressiveMesh.add_collapses(simplifier))
+        {
+        progressiveValid = false;
+        }
+      };
+
+    // Levels of detail: each level is written, then decimation continues
+    // from it, so all levels together cost about as much as the final one
+    std::vector<float> lodFactors;
+    for (float factor : settings.LodReductionFactors)
+      {
+      if (factor > 0 && factor < reductionFactor && !settings.Lossless)
+        {
+        lodFactors.push_back(factor);
+        }
+      else
+        {
+        err << "Level of detail reduction factor " << factor << " is ignored, it must be between 0 and the reduction factor." << std::endl;
+        }
+      }
+    std::sort(lodFactors.begin(), lodFactors.end());
+    lodFactors.erase(std::unique(lodFactors.begin(), lodFactors.end()), lodFactors.end());
+    std::string lodPath = vtksys::SystemTools::GetFilenamePath(outputModel);
+    std::string lodName = vtksys::SystemTools::GetFilenameWithoutLastExtension(outputModel);
+    for (size_t level = 0; level < lodFactors.size() && !simplifier.aborted; ++level)
+      {
+      decimate(round((double)startSize * (1.0 - lodFactors[level])));
+      if (simplifier.aborted)
+        {
+        break;
+        }
+      std::string lodModel = (lodPath.empty() ? "" : lodPath + "/") + lodName + "_lod" + std::to_string(level) + outputModelExt;
+      if (!WriteModel(simplifier, inputPolyData, lodModel, outputModelExt, err))
+        {
+        return false;
+        }
+      out << "Level of detail " << level << ": " << simplifier.triangles.size() << " triangles ("
+        << lodFactors[level] << " reduction): " << lodModel << std::endl;
+      }
+    if (!simplifier.aborted)
+      {
+      decimate(target_count);
+      }
+    result.DecimationTime = SecondsSince(startTime);
+    if (progressive && !simplifier.aborted)
+      {
+      if (!progressiveValid || !progressiveMesh.build(simplifier) || !progressiveMesh.write(settings.ProgressiveModel.c_str()))
+        {
+        err << "Failed to write progressive model: " << settings.ProgressiveModel << std::endl;
+        return false;
+        }
+      out << "Progressive model: " << progressiveMesh.base_triangle_count << " to "
+        << progressiveMesh.triangle_count() << " triangles (" << progressiveMesh.splits.size()
+        << " vertex splits): " << settings.ProgressiveModel << std::endl;
+      }
+    }
+  result.InputTriangles = startSize;
+  if (simplifier.aborted)
     {
-    vtkNew<vtkOBJReader> reader;
-    reader->SetFileName(inputModel.c_str());
-    reader->Update();
-    inputPolyData = reader->GetOutput();
+    err << "Decimation cancelled." << std::endl;
+    result.Cancelled = true;
+    return false;
     }
-  else if (inputModelExt == ".vtp")
+  if (progress)
     {
-    vtkNew<vtkXMLPolyDataReader> reader;
-    reader->SetFileName(inputModel.c_str());
-    reader->Update();
-    inputPolyData = reader->GetOutput();
+    progress->End(result.DecimationTime);
     }
-  else
+  if (simplifier.triangles.size() >= startSize)
     {
-    std::cerr << "Input mesh is expected in OBJ or VTP file format." << std::endl;
-    return EXIT_FAILURE;
+    err << "Unable to reduce mesh." << std::endl;
+    return false;
+    }
+  auto writeStartTime = std::chrono::steady_clock::now();
+  if (!WriteModel(simplifier, inputPolyData, outputModel, outputModelExt, err))
+    {
+    return false;
     }
+  result.WriteTime = SecondsSince(writeStartTime);
+  result.OutputTriangles = simplifier.triangles.size();
+  result.AchievedError = simplifier.collapse_error;
+  double achievedReduction = 1.0 - (double)simplifier.triangles.size() / (double)startSize;
+  out << "Output: " << simplifier.vertices.size() << " vertices,"
+    << simplifier.triangles.size() << " triangles (" << achievedReduction << " reduction)" << std::endl;
+  if (!settings.Lossless)
+    {
+    out << "Achieved error: " << simplifier.collapse_error;
+    if (settings.MaxError > 0)
+      {
+      out << " (maximum " << settings.MaxError << ")";
+      }
+    out << std::endl;
+    }
+  out << method << " decimation time: " << result.DecimationTime << " s" << std::endl;
+  metrics.measure(simplifier);
+  MeasureOutput(metrics, out, result);
+  return true;
+}
 
-  // Triangulate input mesh
-  vtkNew<vtkTriangleFilter> triangles;
-  triangles->SetInputData(inputPolyData);
-  triangles->Update();
-  inputPolyData = triangles->GetOutput();
+//----------------------------------------------------------------------------
+// Decimate a model with a VTK decimation filter
+bool DecimateVTK(const DecimationSettings& settings, const std::string& inputModel, const std::string& outputModel,
+  double reductionFactor, std::ostream& out, std::ostream& err, DecimationResult& result)
+{
+  std::string inputModelExt = vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(inputModel));
+  std::string outputModelExt = vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(outputModel));
+
+  // Read and triangulate the input model
+  auto readStartTime = std::chrono::steady_clock::now();
+  vtkSmartPointer<vtkPolyData> inputPolyData = ReadPolyData(inputModel, inputModelExt, err);
+  if (!inputPolyData)
+    {
+    return false;
+    }
+  result.ReadTime = SecondsSince(readStartTime);
+  auto triangulateStartTime = std::chrono::steady_clock::now();
+  inputPolyData = Triangulate(inputPolyData);
+  result.TriangulateTime = SecondsSince(triangulateStartTime);
+  result.InputTriangles = inputPolyData->GetNumberOfPolys();
+
+  FastQuadricMeshMetrics metrics;
+  metrics.threads = settings.Threads;
+  if (settings.MeasureError)
+    {
+    std::vector<vec3f> inputPoints;
+    std::vector<int> inputTriangles;
+    FastQuadricGetTriangles(inputPolyData, inputPoints, inputTriangles);
+    metrics.set_input(inputPoints, inputTriangles);
+    }
 
+  auto startTime = std::chrono::steady_clock::now();
   vtkSmartPointer<vtkPolyData> outputPolyData;
-  if (method == "Quadric")
+  if (settings.Method == "Quadric")
     {
     vtkNew<vtkQuadricDecimation> decimate;
     decimate->SetInputData(inputPolyData);
     decimate->SetTargetReduction(reductionFactor);
-    //decimate->SetVolumePreservation(true);
+    decimate->SetVolumePreservation(settings.VolumePreservation);
     decimate->Update();
     outputPolyData = decimate->GetOutput();
     }
@@ -109,32 +691,417 @@ int main(int argc, char* argv[])
     vtkNew<vtkDecimatePro> decimate;
     decimate->SetInputData(inputPolyData);
     decimate->SetTargetReduction(reductionFactor);
-    decimate->SetBoundaryVertexDeletion(boundaryDeletion);
+    decimate->SetBoundaryVertexDeletion(settings.BoundaryDeletion);
     decimate->PreserveTopologyOn();
+    if (settings.MaxError > 0)
+      {
+      decimate->ErrorIsAbsoluteOn();
+      decimate->SetAbsoluteError(settings.MaxError);
+      }
     decimate->Update();
     outputPolyData = decimate->GetOutput();
     }
+  result.DecimationTime = SecondsSince(startTime);
+  // the input is not needed anymore, release it before writing
+  inputPolyData = nullptr;
+  result.OutputTriangles = outputPolyData->GetNumberOfPolys();
 
   //Write to file
-  if (outputModelExt == ".obj")
+  auto writeStartTime = std::chrono::steady_clock::now();
+  if (!WritePolyData(outputPolyData, outputModel, outputModelExt, err))
     {
-    vtkNew<vtkOBJWriter> writer;
-    writer->SetFileName(outputModel.c_str());
-    writer->SetInputData(outputPolyData);
-    writer->Update();
+    return false;
     }
-  else if (outputModelExt == ".vtp")
+  result.WriteTime = SecondsSince(writeStartTime);
+  std::vector<vec3f> outputPoints;
+  std::vector<int> outputTriangles;
+  FastQuadricGetTriangles(outputPolyData, outputPoints, outputTriangles);
+  metrics.measure(outputPoints, outputTriangles);
+  MeasureOutput(metrics, out, result);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool DecimateModel(const DecimationSettings& settings, const std::string& inputModel, const std::string& outputModel,
+  double reductionFactor, ProgressReporter* progress, std::ostream& out, std::ostream& err, DecimationResult& result)
+{
+  if (settings.Method == "FastQuadric" || settings.Method == "FastQuadricHeap" || settings.Method == "ParallelQuadric"
+    || settings.Method == "Clustering")
     {
-    vtkNew<vtkXMLPolyDataWriter> writer;
-    writer->SetFileName(outputModel.c_str());
-    writer->SetInputData(outputPolyData);
-    writer->Update();
+    return DecimateFastQuadric(settings, inputModel, outputModel, reductionFactor, progress, out, err, result);
     }
-  else
+  return DecimateVTK(settings, inputModel, outputModel, reductionFactor, out, err, result);
+}
+
+//----------------------------------------------------------------------------
+// Batch mode
+
+struct BatchItem
+  {
+  std::string InputModel;
+  std::string OutputModel;
+  double ReductionFactor = 0.0;
+  bool Done = false;
+  bool Success = false;
+  double Time = 0.0;
+  std::string Messages;
+  DecimationResult Result;
+  };
+
+//----------------------------------------------------------------------------
+std::string Trim(const std::string& text)
+{
+  size_t begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos)
     {
-    std::cerr << "Output mesh can be written in OBJ or VTP file format." << std::endl;
-    return EXIT_FAILURE;
+    return std::string();
+    }
+  size_t end = text.find_last_not_of(" \t\r\n");
+  return text.substr(begin, end - begin + 1);
+}
+
+//----------------------------------------------------------------------------
+// Read the models of a manifest: one model per line, as comma-separated input
+// path, output path, and optionally reduction factor. Empty lines and lines
+// starting with # are skipped. Relative paths are relative to the manifest.
+bool ReadBatchManifest(const std::string& manifest, double defaultReductionFactor, std::vector<BatchItem>& items)
+{
+  std::ifstream file(manifest);
+  if (!file)
+    {
+    std::cerr << "Failed to read batch manifest: " << manifest << std::endl;
+    return false;
+    }
+  std::string baseDirectory = vtksys::SystemTools::GetFilenamePath(vtksys::SystemTools::CollapseFullPath(manifest));
+  std::string line;
+  for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+    {
+    line = Trim(line);
+    if (line.empty() || line[0] == '#')
+      {
+      continue;
+      }
+    std::vector<std::string> fields;
+    std::stringstream lineStream(line);
+    std::string field;
+    while (std::getline(lineStream, field, ','))
+      {
+      fields.push_back(Trim(field));
+      }
+    BatchItem item;
+    item.ReductionFactor = defaultReductionFactor;
+    bool valid = (fields.size() == 2 || fields.size() == 3) && !fields[0].empty() && !fields[1].empty();
+    if (valid && fields.size() == 3)
+      {
+      char* end = nullptr;
+      item.ReductionFactor = strtod(fields[2].c_str(), &end);
+      valid = (end != fields[2].c_str() && *end == 0 && item.ReductionFactor >= 0.0 && item.ReductionFactor <= 1.0);
+      }
+    if (!valid)
+      {
+      std::cerr << manifest << ":" << lineNumber << ": expected input model, output model[, reduction factor between 0 and 1]" << std::endl;
+      return false;
+      }
+    item.InputModel = vtksys::SystemTools::CollapseFullPath(fields[0], baseDirectory);
+    item.OutputModel = vtksys::SystemTools::CollapseFullPath(fields[1], baseDirectory);
+    items.push_back(item);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Find the models matching a file name pattern (e.g. /data/*.vtp), outputs
+// have the same name in the output directory
+bool GlobBatchInput(const std::string& pattern, const std::string& outputDirectory, double reductionFactor, std::vector<BatchItem>& items)
+{
+  if (outputDirectory.empty())
+    {
+    std::cerr << "Batch output directory must be set for batch input pattern." << std::endl;
+    return false;
+    }
+  vtksys::Glob glob;
+  if (!glob.FindFiles(pattern))
+    {
+    std::cerr << "Invalid batch input pattern: " << pattern << std::endl;
+    return false;
+    }
+  std::vector<std::string> files = glob.GetFiles();
+  std::sort(files.begin(), files.end());
+  vtksys::SystemTools::MakeDirectory(outputDirectory);
+  for (const std::string& file : files)
+    {
+    BatchItem item;
+    item.InputModel = file;
+    item.OutputModel = outputDirectory + "/" + vtksys::SystemTools::GetFilenameName(file);
+    item.ReductionFactor = reductionFactor;
+    items.push_back(item);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+std::string JSONString(const std::string& text)
+{
+  std::string quoted = "\"";
+  for (char c : text)
+    {
+    switch (c)
+      {
+      case '"': quoted += "\\\""; break;
+      case '\\': quoted += "\\\\"; break;
+      case '\n': quoted += "\\n"; break;
+      case '\r': quoted += "\\r"; break;
+      case '\t': quoted += "\\t"; break;
+      default:
+        if ((unsigned char)c < 0x20)
+          {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+          quoted += escaped;
+          }
+        else
+          {
+          quoted += c;
+          }
+      }
+    }
+  return quoted + "\"";
+}
+
+//----------------------------------------------------------------------------
+std::string JoinValues(const std::vector<int>& values, const char* separator)
+{
+  std::ostringstream joined;
+  for (size_t i = 0; i < values.size(); ++i)
+    {
+    joined << (i > 0 ? separator : "") << values[i];
+    }
+  return joined.str();
+}
+
+//----------------------------------------------------------------------------
+bool WriteBatchReport(const std::string& fileName, const std::string& method, const std::vector<BatchItem>& items, double totalTime)
+{
+  std::ofstream file(fileName);
+  if (!file)
+    {
+    std::cerr << "Failed to write batch report: " << fileName << std::endl;
+    return false;
+    }
+  size_t succeeded = std::count_if(items.begin(), items.end(), [](const BatchItem& item) { return item.Success; });
+  file << "{\n"
+    << "  \"method\": " << JSONString(method) << ",\n"
+    << "  \"models\": " << items.size() << ",\n"
+    << "  \"succeeded\": " << succeeded << ",\n"
+    << "  \"failed\": " << items.size() - succeeded << ",\n"
+    << "  \"totalTime\": " << totalTime << ",\n"
+    << "  \"peakMemory\": " << PeakMemory() << ",\n"
+    << "  \"results\": [";
+  for (size_t i = 0; i < items.size(); ++i)
+    {
+    const BatchItem& item = items[i];
+    const DecimationResult& result = item.Result;
+    std::string status = item.Success ? "succeeded" : (!item.Done ? "skipped" : (result.Cancelled ? "cancelled" : "failed"));
+    double reduction = result.InputTriangles > 0 && item.Success ? 1.0 - (double)result.OutputTriangles / result.InputTriangles : 0.0;
+    file << (i > 0 ? ",\n" : "\n")
+      << "    {\n"
+      << "      \"input\": " << JSONString(item.InputModel) << ",\n"
+      << "      \"output\": " << JSONString(item.OutputModel) << ",\n"
+      << "      \"status\": " << JSONString(status) << ",\n"
+      << "      \"reductionFactor\": " << item.ReductionFactor << ",\n"
+      << "      \"inputTriangles\": " << result.InputTriangles << ",\n"
+      << "      \"outputTriangles\": " << result.OutputTriangles << ",\n"
+      << "      \"achievedReduction\": " << reduction << ",\n"
+      << "      \"achievedError\": " << result.AchievedError << ",\n"
+      << "      \"hausdorffDistance\": " << result.HausdorffDistance << ",\n"
+      << "      \"meanDistance\": " << result.MeanDistance << ",\n"
+      << "      \"aspectRatioHistogram\": [" << JoinValues(result.AspectRatioHistogram, ", ") << "],\n"
+      << "      \"minAngleHistogram\": [" << JoinValues(result.MinAngleHistogram, ", ") << "],\n"
+      << "      \"readTime\": " << result.ReadTime << ",\n"
+      << "      \"triangulateTime\": " << result.TriangulateTime << ",\n"
+      << "      \"decimationTime\": " << result.DecimationTime << ",\n"
+      << "      \"writeTime\": " << result.WriteTime << ",\n"
+      << "      \"totalTime\": " << item.Time << ",\n"
+      << "      \"messages\": " << JSONString(item.Messages) << "\n"
+      << "    }";
+    }
+  file << "\n  ]\n}\n";
+  file.close();
+  if (!file)
+    {
+    std::cerr << "Failed to write batch report: " << fileName << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Write the report of a single model as output parameters of the module
+bool WriteReturnParameters(const std::string& fileName, const DecimationResult& result)
+{
+  std::ofstream file(fileName);
+  if (!file)
+    {
+    std::cerr << "Failed to write return parameter file: " << fileName << std::endl;
+    return false;
+    }
+  double reduction = result.InputTriangles > 0 ? 1.0 - (double)result.OutputTriangles / result.InputTriangles : 0.0;
+  file << "loadTime = " << result.ReadTime << std::endl;
+  file << "triangulateTime = " << result.TriangulateTime << std::endl;
+  file << "decimationTime = " << result.DecimationTime << std::endl;
+  file << "writeTime = " << result.WriteTime << std::endl;
+  file << "peakMemory = " << PeakMemory() << std::endl;
+  file << "inputTriangles = " << result.InputTriangles << std::endl;
+  file << "outputTriangles = " << result.OutputTriangles << std::endl;
+  file << "achievedReduction = " << reduction << std::endl;
+  file << "hausdorffDistance = " << result.HausdorffDistance << std::endl;
+  file << "meanDistance = " << result.MeanDistance << std::endl;
+  file << "aspectRatioHistogram = " << JoinValues(result.AspectRatioHistogram, ",") << std::endl;
+  file << "minAngleHistogram = " << JoinValues(result.MinAngleHistogram, ",") << std::endl;
+  file.close();
+  if (!file)
+    {
+    std::cerr << "Failed to write return parameter file: " << fileName << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Decimate all models of the batch, several models at a time on one thread
+// each. Largest inputs are started first so that the workers finish at about
+// the same time. Progress is reported after each model.
+bool RunBatch(DecimationSettings settings, std::vector<BatchItem>& items, ProgressReporter& progress, const std::string& reportFile)
+{
+  int threadCount = settings.Threads > 0 ? settings.Threads : (int)std::thread::hardware_concurrency();
+  threadCount = std::max(threadCount, 1);
+  FastQuadricThreadPool pool(threadCount);
+  settings.Threads = 1;
+  if (!settings.ProgressiveModel.empty())
+    {
+    std::cerr << "Progressive model is ignored in batch mode." << std::endl;
+    settings.ProgressiveModel.clear();
     }
 
+  std::vector<unsigned long> inputSizes(items.size());
+  std::vector<int> order(items.size());
+  for (size_t i = 0; i < items.size(); ++i)
+    {
+    inputSizes[i] = vtksys::SystemTools::FileLength(items[i].InputModel);
+    order[i] = int(i);
+    }
+  std::stable_sort(order.begin(), order.end(), [&inputSizes](int a, int b) { return inputSizes[a] > inputSizes[b]; });
+
+  std::cout << "Batch: " << items.size() << " models, " << threadCount << " threads" << std::endl;
+  auto startTime = std::chrono::steady_clock::now();
+  progress.Start(settings.Method + " batch decimation");
+  std::mutex mutex;
+  std::atomic<bool> cancelled(false);
+  size_t doneCount = 0;
+  pool.run(int(items.size()), [&](int task)
+    {
+    if (cancelled)
+      {
+      return;
+      }
+    BatchItem& item = items[order[task]];
+    std::ostringstream messages;
+    auto itemStartTime = std::chrono::steady_clock::now();
+    item.Success = DecimateModel(settings, item.InputModel, item.OutputModel, item.ReductionFactor,
+      nullptr, messages, messages, item.Result);
+    item.Time = SecondsSince(itemStartTime);
+    item.Messages = messages.str();
+    item.Done = true;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    doneCount++;
+    std::cout << "[" << doneCount << "/" << items.size() << "] " << (item.Success ? "" : "FAILED ")
+      << item.InputModel << " -> " << item.OutputModel << ": " << item.Result.InputTriangles << " -> "
+      << item.Result.OutputTriangles << " triangles, " << item.Time << " s" << std::endl;
+    if (!item.Success || settings.Verbose)
+      {
+      std::cout << item.Messages;
+      }
+    std::string message = std::to_string(doneCount) + " of " + std::to_string(items.size()) + " models decimated";
+    if (!progress.Report((double)doneCount / items.size(), message.c_str()))
+      {
+      cancelled = true;
+      }
+    });
+  double totalTime = SecondsSince(startTime);
+  progress.End(totalTime);
+
+  size_t succeeded = std::count_if(items.begin(), items.end(), [](const BatchItem& item) { return item.Success; });
+  std::cout << "Batch: " << succeeded << " of " << items.size() << " models decimated in " << totalTime << " s" << std::endl;
+  if (!reportFile.empty() && !WriteBatchReport(reportFile, settings.Method, items, totalTime))
+    {
+    return false;
+    }
+  if (cancelled)
+    {
+    std::cerr << "Decimation cancelled." << std::endl;
+    return false;
+    }
+  return succeeded == items.size();
+}
+
+} // end of anonymous namespace
+
+int main(int argc, char* argv[])
+{
+  PARSE_ARGS;
+
+  DecimationSettings settings;
+  settings.Method = method;
+  settings.MaxError = maxError;
+  settings.LodReductionFactors = lodReductionFactors;
+  settings.ProgressiveModel = progressiveModel;
+  settings.BoundaryDeletion = boundaryDeletion;
+  settings.BoundaryWeight = boundaryWeight;
+  settings.FeatureAngle = featureAngle;
+  settings.FeatureWeight = featureWeight;
+  settings.Lossless = lossless;
+  settings.VolumePreservation = volumePreservation;
+  settings.Aggressiveness = aggressiveness;
+  settings.PreCluster = preCluster;
+  settings.Threads = threads;
+  settings.Deterministic = deterministic;
+  settings.MemoryBudget = memoryBudget;
+  settings.MeasureError = measureError;
+  settings.Verbose = verbose;
+
+  ProgressReporter progress;
+  progress.ProcessInformation = CLPProcessInformation;
+
+  if (!batchManifest.empty() || !batchInput.empty())
+    {
+    // The input and output model arguments are not used in batch mode
+    std::vector<BatchItem> items;
+    if (!batchManifest.empty() && !ReadBatchManifest(batchManifest, reductionFactor, items))
+      {
+      return EXIT_FAILURE;
+      }
+    if (!batchInput.empty() && !GlobBatchInput(batchInput, batchOutputDirectory, reductionFactor, items))
+      {
+      return EXIT_FAILURE;
+      }
+    if (items.empty())
+      {
+      std::cerr << "No models found for batch decimation." << std::endl;
+      return EXIT_FAILURE;
+      }
+    return RunBatch(settings, items, progress, batchReport) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+  DecimationResult result;
+  if (!DecimateModel(settings, inputModel, outputModel, reductionFactor, &progress, std::cout, std::cerr, result))
+    {
+    return EXIT_FAILURE;
+    }
+  std::cout << "Peak memory: " << PeakMemory() << " MB" << std::endl;
+  if (!returnParameterFile.empty() && !WriteReturnParameters(returnParameterFile, result))
+    {
+    return EXIT_FAILURE;
+    }
   return EXIT_SUCCESS;
 }
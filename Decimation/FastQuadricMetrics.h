@@ -0,0 +1,358 @@
+// Quality metrics of a decimated mesh, for the report of the Decimation
+// module.
+//
+// The geometric error is measured from the vertices of the input mesh to the
+// output surface: the largest distance (one-sided Hausdorff distance) and the
+// mean distance. Closest points are found in a uniform grid of the output
+// triangles, the queries run in parallel on a FastQuadricThreadPool.
+//
+// The shape of the output triangles is summarized in two histograms:
+//   aspect ratio (longest edge * perimeter / (4*sqrt(3)*area), 1 for
+//   equilateral triangles) with bins [1,1.5) [1.5,2) [2,3) [3,5) [5,10)
+//   [10,inf), degenerate triangles are counted in the last bin
+//   minimum angle in degrees with bins [0,10) [10,20) ... [50,60]
+
+#ifndef __FastQuadricMetrics_h
+#define __FastQuadricMetrics_h
+
+#include "Simplify.h"
+
+class FastQuadricMeshMetrics
+{
+public:
+    enum { histogram_bins = 6 };
+
+    // Number of threads of the distance queries, 0 means all cores
+    int threads = 0;
+
+    // Results of measure(), distances are -1 if no input was set
+    double hausdorff_distance = -1;
+    double mean_distance = -1;
+    std::vector<int> aspect_ratio_histogram;
+    std::vector<int> min_angle_histogram;
+
+    // Store the vertices of the input mesh (the ones used by triangles) as
+    // the sample points of the distance measurement. Call it before the
+    // mesh is simplified.
+    void set_input(const FastQuadricSimplifier &simplifier)
+    {
+        std::vector<char> used(simplifier.vertices.size(), 0);
+        for(const FastQuadricSimplifier::Triangle &t: simplifier.triangles)
+        {
+            for(int j: {0, 1, 2}) { used[t.v[j]] = 1; }
+        }
+        samples.clear();
+        for(size_t i = 0; i < used.size(); ++i)
+        {
+            if(used[i]) samples.push_back(simplifier.vertices[i].p);
+        }
+    }
+
+    void set_input(const std::vector<vec3f> &points, const std::vector<int> &triangles)
+    {
+        std::vector<char> used(points.size(), 0);
+        for(int i: triangles) { used[i] = 1; }
+        samples.clear();
+        for(size_t i = 0; i < used.size(); ++i)
+        {
+            if(used[i]) samples.push_back(points[i]);
+        }
+    }
+
+    bool has_input() const { return !samples.empty(); }
+
+    // Measure the output mesh of a simplification
+    void measure(const FastQuadricSimplifier &simplifier)
+    {
+        std::vector<vec3f> points(simplifier.vertices.size());
+        for(size_t i = 0; i < points.size(); ++i) { points[i] = simplifier.vertices[i].p; }
+        std::vector<int> triangles(3*simplifier.triangles.size());
+        for(size_t i = 0; i < simplifier.triangles.size(); ++i)
+        {
+            for(int j: {0, 1, 2}) { triangles[3*i+j] = simplifier.triangles[i].v[j]; }
+        }
+        measure(points, triangles);
+    }
+
+    // Measure the output mesh given as points and 3 point indices per triangle
+    void measure(const std::vector<vec3f> &points, const std::vector<int> &triangles)
+    {
+        int thread_count = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+        FastQuadricThreadPool pool(std::max(thread_count, 1));
+        measure_shape(pool, points, triangles);
+        hausdorff_distance = -1;
+        mean_distance = -1;
+        if(!samples.empty() && !triangles.empty())
+        {
+            build_grid(points, triangles);
+            measure_distance(pool, points, triangles);
+            cell_start.clear(); cell_triangles.clear();
+        }
+    }
+
+    // Squared distance of point p to triangle abc (Ericson, Real-Time
+    // Collision Detection, 5.1.5)
+    static double point_triangle_distance2(const vec3f &p, const vec3f &a, const vec3f &b, const vec3f &c)
+    {
+        vec3f ab=b-a, ac=c-a, ap=p-a;
+        double d1=ab.dot(ap), d2=ac.dot(ap);
+        if(d1 <= 0 && d2 <= 0) return distance2(p, a);
+        vec3f bp=p-b;
+        double d3=ab.dot(bp), d4=ac.dot(bp);
+        if(d3 >= 0 && d4 <= d3) return distance2(p, b);
+        double vc=d1*d4-d3*d2;
+        if(vc <= 0 && d1 >= 0 && d3 <= 0) return distance2(p, a+ab*(d1/(d1-d3)));
+        vec3f cp=p-c;
+        double d5=ab.dot(cp), d6=ac.dot(cp);
+        if(d6 >= 0 && d5 <= d6) return distance2(p, c);
+        double vb=d5*d2-d1*d6;
+        if(vb <= 0 && d2 >= 0 && d6 <= 0) return distance2(p, a+ac*(d2/(d2-d6)));
+        double va=d3*d6-d5*d4;
+        if(va <= 0 && d4-d3 >= 0 && d5-d6 >= 0) return distance2(p, b+(c-b)*((d4-d3)/((d4-d3)+(d5-d6))));
+        double sum=va+vb+vc;
+        if(!(sum > 0))
+        {
+            // degenerate triangle, closest point is on one of the edges
+            return std::min(point_segment_distance2(p, a, b), std::min(point_segment_distance2(p, b, c), point_segment_distance2(p, c, a)));
+        }
+        return distance2(p, a+ab*(vb/sum)+ac*(vc/sum));
+    }
+
+protected:
+    // Samples are processed in chunks of fixed size, so that the mean does
+    // not depend on the number of threads
+    static const int chunk_size = 4096;
+
+    std::vector<vec3f> samples;
+
+    // Uniform grid of the output triangles: the triangles overlapping cell
+    // (x,y,z) are cell_triangles[cell_start[c]..cell_start[c+1]) with
+    // c=(z*n[1]+y)*n[0]+x
+    vec3f grid_min;
+    double cell_size = 1;
+    int n[3] = {1, 1, 1};
+    std::vector<size_t> cell_start;
+    std::vector<int> cell_triangles;
+
+    static double distance2(const vec3f &a, const vec3f &b)
+    {
+        vec3f d=a-b;
+        return d.dot(d);
+    }
+
+    static double point_segment_distance2(const vec3f &p, const vec3f &a, const vec3f &b)
+    {
+        vec3f ab=b-a;
+        double l=ab.dot(ab);
+        double t=l > 0 ? std::max(0.0, std::min(1.0, (p-a).dot(ab)/l)) : 0.0;
+        return distance2(p, a+ab*t);
+    }
+
+    int cell_coordinate(double x, int axis) const
+    {
+        double c=floor((x-(&grid_min.x)[axis])/cell_size);
+        return int(std::max(0.0, std::min(c, double(n[axis]-1))));
+    }
+
+    // At most 4 cells per triangle and 1024 cells along an axis
+    void build_grid(const std::vector<vec3f> &points, const std::vector<int> &triangles)
+    {
+        size_t triangle_count=triangles.size()/3;
+        vec3f bmin(DBL_MAX,DBL_MAX,DBL_MAX), bmax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+        for(int i: triangles)
+        {
+            const vec3f &p=points[i];
+            bmin=vec3f(std::min(bmin.x,p.x),std::min(bmin.y,p.y),std::min(bmin.z,p.z));
+            bmax=vec3f(std::max(bmax.x,p.x),std::max(bmax.y,p.y),std::max(bmax.z,p.z));
+        }
+        vec3f size=bmax-bmin;
+        double diagonal=sqrt(size.dot(size));
+        double extent[3];
+        for(int a = 0; a < 3; ++a) { extent[a]=std::max((&size.x)[a], diagonal*1e-3); }
+        if(!(diagonal > 0)) { extent[0]=extent[1]=extent[2]=1; }
+        // cells of about twice the size of the triangles, the triangles
+        // are on a surface so most cells are empty
+        double area=0;
+        for(size_t i = 0; i < triangle_count; ++i)
+        {
+            vec3f normal;
+            normal.cross(points[triangles[3*i+1]]-points[triangles[3*i]], points[triangles[3*i+2]]-points[triangles[3*i]]);
+            area+=sqrt(normal.dot(normal))/2;
+        }
+        double cells=std::max(4*double(triangle_count), 1.0);
+        cell_size=std::max(2*sqrt(area/std::max(triangle_count, size_t(1))), cbrt(extent[0]*extent[1]*extent[2]/cells));
+        for(int a = 0; a < 3; ++a) { cell_size=std::max(cell_size, extent[a]/1024); }
+        for(int a = 0; a < 3; ++a) { n[a]=std::max(1, std::min(1024, int(ceil(extent[a]/cell_size)))); }
+        grid_min=bmin;
+
+        // count, then fill the triangles of each cell
+        size_t cell_count=size_t(n[0])*n[1]*n[2];
+        cell_start.assign(cell_count+1, 0);
+        for(int pass = 0; pass < 2; ++pass)
+        {
+            if(pass == 1)
+            {
+                for(size_t c = 0; c < cell_count; ++c) { cell_start[c+1]+=cell_start[c]; }
+                cell_triangles.resize(cell_start[cell_count]);
+            }
+            for(size_t i = 0; i < triangle_count; ++i)
+            {
+                int lo[3], hi[3];
+                for(int a = 0; a < 3; ++a)
+                {
+                    double x0=(&points[triangles[3*i]].x)[a], x1=(&points[triangles[3*i+1]].x)[a], x2=(&points[triangles[3*i+2]].x)[a];
+                    lo[a]=cell_coordinate(std::min(x0,std::min(x1,x2)), a);
+                    hi[a]=cell_coordinate(std::max(x0,std::max(x1,x2)), a);
+                }
+                for(int z = lo[2]; z <= hi[2]; ++z)
+                    for(int y = lo[1]; y <= hi[1]; ++y)
+                        for(int x = lo[0]; x <= hi[0]; ++x)
+                        {
+                            size_t c=(size_t(z)*n[1]+y)*n[0]+x;
+                            if(pass == 0) cell_start[c+1]++;
+                            else cell_triangles[cell_start[c]++]=int(i);
+                        }
+            }
+        }
+        // cell_start[c] was advanced to the end of cell c
+        for(size_t c = cell_count; c > 0; --c) { cell_start[c]=cell_start[c-1]; }
+        cell_start[0]=0;
+    }
+
+    // Squared distance of p to the closest triangle: the cells are searched
+    // in shells of increasing distance around the cell of p, until the
+    // closest triangle found is nearer than any cell not searched yet
+    double closest_distance2(const vec3f &p, const std::vector<vec3f> &points, const std::vector<int> &triangles) const
+    {
+        int c[3];
+        for(int a = 0; a < 3; ++a) { c[a]=cell_coordinate((&p.x)[a], a); }
+        double best=DBL_MAX;
+        for(int r = 0; ; ++r)
+        {
+            int lo[3], hi[3];
+            for(int a = 0; a < 3; ++a) { lo[a]=std::max(c[a]-r, 0); hi[a]=std::min(c[a]+r, n[a]-1); }
+            auto search_cell = [&](int x, int y, int z)
+            {
+                // skip cells farther than the closest triangle found
+                double d2=0;
+                int xyz[3]={x, y, z};
+                for(int a = 0; a < 3; ++a)
+                {
+                    double low=(&grid_min.x)[a]+xyz[a]*cell_size, coordinate=(&p.x)[a];
+                    double d=std::max(low-coordinate, coordinate-(low+cell_size));
+                    if(d > 0) d2+=d*d;
+                }
+                if(d2 >= best) return;
+                size_t cell=(size_t(z)*n[1]+y)*n[0]+x;
+                for(size_t k = cell_start[cell]; k < cell_start[cell+1]; ++k)
+                {
+                    const int *t=&triangles[3*size_t(cell_triangles[k])];
+                    best=std::min(best, point_triangle_distance2(p, points[t[0]], points[t[1]], points[t[2]]));
+                }
+            };
+            // only the cells at distance r (the shell), rows inside the
+            // shell have just their two end cells
+            for(int z = lo[2]; z <= hi[2]; ++z)
+                for(int y = lo[1]; y <= hi[1]; ++y)
+                {
+                    if(abs(z-c[2]) < r && abs(y-c[1]) < r)
+                    {
+                        if(c[0]-r >= 0) search_cell(c[0]-r, y, z);
+                        if(c[0]+r < n[0]) search_cell(c[0]+r, y, z);
+                    }
+                    else
+                    {
+                        for(int x = lo[0]; x <= hi[0]; ++x) { search_cell(x, y, z); }
+                    }
+                }
+            // distance to the nearest cell outside of the searched box
+            double bound=DBL_MAX;
+            for(int a = 0; a < 3; ++a)
+            {
+                double x=(&p.x)[a], origin=(&grid_min.x)[a];
+                if(c[a]-r > 0) bound=std::min(bound, x-(origin+(c[a]-r)*cell_size));
+                if(c[a]+r < n[a]-1) bound=std::min(bound, origin+(c[a]+r+1)*cell_size-x);
+            }
+            if(bound == DBL_MAX || best <= bound*bound) return best;
+        }
+    }
+
+    void measure_distance(FastQuadricThreadPool &pool, const std::vector<vec3f> &points, const std::vector<int> &triangles)
+    {
+        int chunk_count=int((samples.size()+chunk_size-1)/chunk_size);
+        std::vector<double> chunk_max(chunk_count, 0.0), chunk_sum(chunk_count, 0.0);
+        std::atomic<int> next_chunk(0);
+        pool.run(pool.size(), [&](int)
+        {
+            for(int k = next_chunk++; k < chunk_count; k = next_chunk++)
+            {
+                size_t end=std::min(samples.size(), size_t(k+1)*chunk_size);
+                for(size_t i = size_t(k)*chunk_size; i < end; ++i)
+                {
+                    double d=sqrt(closest_distance2(samples[i], points, triangles));
+                    chunk_max[k]=std::max(chunk_max[k], d);
+                    chunk_sum[k]+=d;
+                }
+            }
+        });
+        double sum=0;
+        hausdorff_distance=0;
+        for(int k = 0; k < chunk_count; ++k)
+        {
+            hausdorff_distance=std::max(hausdorff_distance, chunk_max[k]);
+            sum+=chunk_sum[k];
+        }
+        mean_distance=sum/samples.size();
+    }
+
+    void measure_shape(FastQuadricThreadPool &pool, const std::vector<vec3f> &points, const std::vector<int> &triangles)
+    {
+        static const double aspect_ratio_bounds[histogram_bins-1] = {1.5, 2, 3, 5, 10};
+        const double pi=3.14159265358979323846;
+        size_t triangle_count=triangles.size()/3;
+        int chunk_count=int((triangle_count+chunk_size-1)/chunk_size);
+        std::vector<int> histograms(size_t(chunk_count)*2*histogram_bins, 0);
+        std::atomic<int> next_chunk(0);
+        pool.run(pool.size(), [&](int)
+        {
+            for(int k = next_chunk++; k < chunk_count; k = next_chunk++)
+            {
+                int *aspect_ratio=&histograms[size_t(k)*2*histogram_bins];
+                int *min_angle=aspect_ratio+histogram_bins;
+                size_t end=std::min(triangle_count, size_t(k+1)*chunk_size);
+                for(size_t i = size_t(k)*chunk_size; i < end; ++i)
+                {
+                    const vec3f *p[3]={&points[triangles[3*i]], &points[triangles[3*i+1]], &points[triangles[3*i+2]]};
+                    double length[3], angle=pi;
+                    for(int j = 0; j < 3; ++j)
+                    {
+                        vec3f e0=*p[(j+1)%3]-*p[j], e1=*p[(j+2)%3]-*p[j], normal;
+                        normal.cross(e0, e1);
+                        length[j]=sqrt(e0.dot(e0));
+                        angle=std::min(angle, atan2(sqrt(normal.dot(normal)), e0.dot(e1)));
+                    }
+                    vec3f normal;
+                    normal.cross(*p[1]-*p[0], *p[2]-*p[0]);
+                    double area=sqrt(normal.dot(normal))/2;
+                    double ratio=std::max(length[0],std::max(length[1],length[2]))*(length[0]+length[1]+length[2])/(4*sqrt(3.0)*area);
+                    int bin=0;
+                    while(bin < histogram_bins-1 && !(ratio < aspect_ratio_bounds[bin])) bin++;
+                    aspect_ratio[bin]++;
+                    min_angle[std::max(0, std::min(histogram_bins-1, int(angle*180/pi/10)))]++;
+                }
+            }
+        });
+        aspect_ratio_histogram.assign(histogram_bins, 0);
+        min_angle_histogram.assign(histogram_bins, 0);
+        for(int k = 0; k < chunk_count; ++k)
+        {
+            for(int b = 0; b < histogram_bins; ++b)
+            {
+                aspect_ratio_histogram[b]+=histograms[(size_t(k)*2)*histogram_bins+b];
+                min_angle_histogram[b]+=histograms[(size_t(k)*2+1)*histogram_bins+b];
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,310 @@
+// Conversion between vtkPolyData and the FastQuadricSimplifier mesh arrays.
+// Points, triangles and point data arrays are copied directly between the
+// VTK arrays and the simplifier arrays, without going through a file.
+
+#ifndef __FastQuadricPolyData_h
+#define __FastQuadricPolyData_h
+
+// VTK includes
+#include "vtkCellArray.h"
+#include "vtkCellArrayIterator.h"
+#include "vtkDoubleArray.h"
+#include "vtkFloatArray.h"
+#include "vtkIdTypeArray.h"
+#include "vtkMath.h"
+#include "vtkNew.h"
+#include "vtkPointData.h"
+#include "vtkPoints.h"
+#include "vtkPolyData.h"
+#include "vtkSmartPointer.h"
+#include "vtkTemplateAliasMacro.h"
+
+// STD includes
+#include <cmath>
+#include <limits>
+
+#include "Simplify.h"
+
+//----------------------------------------------------------------------------
+template <typename T>
+inline void FastQuadricCopyPoints(const T* coords, std::vector<FastQuadricSimplifier::Vertex>& vertices)
+{
+  for (FastQuadricSimplifier::Vertex& v : vertices)
+    {
+    v.p.x = coords[0];
+    v.p.y = coords[1];
+    v.p.z = coords[2];
+    coords += 3;
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename T>
+inline void FastQuadricCopyPoints(const std::vector<FastQuadricSimplifier::Vertex>& vertices, T* coords)
+{
+  for (const FastQuadricSimplifier::Vertex& v : vertices)
+    {
+    coords[0] = static_cast<T>(v.p.x);
+    coords[1] = static_cast<T>(v.p.y);
+    coords[2] = static_cast<T>(v.p.z);
+    coords += 3;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Returns true if T is an integer type, whose values are labels that must
+// not be interpolated
+template <typename T>
+inline bool FastQuadricCopyComponent(const T* tuples, int numberOfComponents, int component, vtkIdType numberOfTuples, float* values)
+{
+  tuples += component;
+  for (vtkIdType i = 0; i < numberOfTuples; ++i, tuples += numberOfComponents)
+    {
+    values[i] = static_cast<float>(*tuples);
+    }
+  return std::numeric_limits<T>::is_integer;
+}
+
+//----------------------------------------------------------------------------
+template <typename T>
+inline void FastQuadricCopyComponent(const float* values, vtkIdType numberOfTuples, int numberOfComponents, int component, T* tuples)
+{
+  tuples += component;
+  for (vtkIdType i = 0; i < numberOfTuples; ++i, tuples += numberOfComponents)
+    {
+    // values of integer arrays are not interpolated, they are only rounded
+    // in case they are not exactly representable as float
+    *tuples = std::numeric_limits<T>::is_integer ? static_cast<T>(std::lround(values[i])) : static_cast<T>(values[i]);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Check if a mesh consists only of triangles (as marching cubes output), so
+// that it does not need to be triangulated. Only the cell sizes are checked,
+// which is much faster than running vtkTriangleFilter on it.
+inline bool FastQuadricIsTriangleMesh(vtkPolyData* polyData)
+{
+  return polyData->GetNumberOfPolys() > 0
+    && polyData->GetNumberOfVerts() == 0
+    && polyData->GetNumberOfLines() == 0
+    && polyData->GetNumberOfStrips() == 0
+    && polyData->GetPolys()->IsHomogeneous() == 3;
+}
+
+//----------------------------------------------------------------------------
+// Copy points, triangles and point data of a triangulated mesh into the
+// simplifier arrays. Each component of each point data array is stored as a
+// vertex attribute, in the order of the arrays. Components of integer arrays
+// (such as labels or segment IDs) are marked as discrete, so they are not
+// interpolated; they are exact up to 2^24, the precision of the float
+// attribute values.
+inline void FastQuadricImportPolyData(vtkPolyData* polyData, FastQuadricSimplifier& simplifier)
+{
+  vtkDataArray* coords = polyData->GetPoints()->GetData();
+  simplifier.vertices.resize(polyData->GetNumberOfPoints());
+  if (vtkFloatArray::SafeDownCast(coords))
+    {
+    FastQuadricCopyPoints(vtkFloatArray::SafeDownCast(coords)->GetPointer(0), simplifier.vertices);
+    }
+  else if (vtkDoubleArray::SafeDownCast(coords))
+    {
+    FastQuadricCopyPoints(vtkDoubleArray::SafeDownCast(coords)->GetPointer(0), simplifier.vertices);
+    }
+  else
+    {
+    for (vtkIdType i = 0; i < polyData->GetNumberOfPoints(); ++i)
+      {
+      double* p = coords->GetTuple3(i);
+      simplifier.vertices[i].p = vec3f(p[0], p[1], p[2]);
+      }
+    }
+
+  vtkPointData* pointData = polyData->GetPointData();
+  vtkIdType numberOfPoints = polyData->GetNumberOfPoints();
+  int attributeComponents = 0;
+  for (int a = 0; a < pointData->GetNumberOfArrays(); ++a)
+    {
+    vtkDataArray* array = pointData->GetArray(a);
+    attributeComponents += array ? array->GetNumberOfComponents() : 0;
+    }
+  simplifier.vertex_attribute_components = attributeComponents;
+  simplifier.vertex_attributes.resize(static_cast<size_t>(attributeComponents) * numberOfPoints);
+  simplifier.vertex_attribute_discrete.assign(attributeComponents, 0);
+  char* discrete = simplifier.vertex_attribute_discrete.data();
+  float* values = simplifier.vertex_attributes.data();
+  for (int a = 0; a < pointData->GetNumberOfArrays(); ++a)
+    {
+    vtkDataArray* array = pointData->GetArray(a);
+    if (!array)
+      {
+      continue;
+      }
+    int numberOfComponents = array->GetNumberOfComponents();
+    for (int c = 0; c < numberOfComponents; ++c, values += numberOfPoints, ++discrete)
+      {
+      switch (array->GetDataType())
+        {
+        vtkTemplateAliasMacro(*discrete = FastQuadricCopyComponent(static_cast<const VTK_TT*>(array->GetVoidPointer(0)),
+          numberOfComponents, c, numberOfPoints, values));
+        default:
+          for (vtkIdType i = 0; i < numberOfPoints; ++i)
+            {
+            values[i] = static_cast<float>(array->GetComponent(i, c));
+            }
+        }
+      }
+    }
+
+  vtkCellArray* polys = polyData->GetPolys();
+  simplifier.triangles.reserve(polys->GetNumberOfCells());
+  vtkSmartPointer<vtkCellArrayIterator> it = vtk::TakeSmartPointer(polys->NewIterator());
+  for (it->GoToFirstCell(); !it->IsDoneWithTraversal(); it->GoToNextCell())
+    {
+    vtkIdType npts;
+    const vtkIdType* pts;
+    it->GetCurrentCell(npts, pts);
+    if (npts != 3)
+      {
+      continue;
+      }
+    FastQuadricSimplifier::Triangle t;
+    for (int j = 0; j < 3; ++j)
+      {
+      t.v[j] = static_cast<int>(pts[j]);
+      }
+    t.deleted = 0;
+    t.dirty = 0;
+    t.attr = 0;
+    simplifier.triangles.push_back(t);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Copy the points and the triangles (3 point indices each) of a triangulated
+// mesh, e.g. for measuring it with FastQuadricMeshMetrics.
+inline void FastQuadricGetTriangles(vtkPolyData* polyData, std::vector<vec3f>& points, std::vector<int>& triangles)
+{
+  vtkIdType numberOfPoints = polyData->GetNumberOfPoints();
+  points.resize(numberOfPoints);
+  for (vtkIdType i = 0; i < numberOfPoints; ++i)
+    {
+    double p[3];
+    polyData->GetPoint(i, p);
+    points[i] = vec3f(p[0], p[1], p[2]);
+    }
+  vtkCellArray* polys = polyData->GetPolys();
+  triangles.clear();
+  triangles.reserve(3 * polys->GetNumberOfCells());
+  vtkSmartPointer<vtkCellArrayIterator> it = vtk::TakeSmartPointer(polys->NewIterator());
+  for (it->GoToFirstCell(); !it->IsDoneWithTraversal(); it->GoToNextCell())
+    {
+    vtkIdType npts;
+    const vtkIdType* pts;
+    it->GetCurrentCell(npts, pts);
+    if (npts != 3)
+      {
+      continue;
+      }
+    for (int j = 0; j < 3; ++j)
+      {
+      triangles.push_back(static_cast<int>(pts[j]));
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Create a mesh from the simplifier arrays. Point coordinates and point data
+// arrays get the same type, name and attribute role as in the imported
+// source mesh. Points are stored as float if there is no source mesh.
+inline vtkSmartPointer<vtkPolyData> FastQuadricExportPolyData(const FastQuadricSimplifier& simplifier, vtkPolyData* source)
+{
+  int pointDataType = source ? source->GetPoints()->GetDataType() : VTK_FLOAT;
+  vtkNew<vtkPoints> points;
+  points->SetDataType(pointDataType == VTK_DOUBLE ? VTK_DOUBLE : VTK_FLOAT);
+  points->SetNumberOfPoints(simplifier.vertices.size());
+  if (pointDataType == VTK_DOUBLE)
+    {
+    FastQuadricCopyPoints(simplifier.vertices, vtkDoubleArray::SafeDownCast(points->GetData())->GetPointer(0));
+    }
+  else
+    {
+    FastQuadricCopyPoints(simplifier.vertices, vtkFloatArray::SafeDownCast(points->GetData())->GetPointer(0));
+    }
+
+  vtkIdType triangleCount = simplifier.triangles.size();
+  vtkNew<vtkIdTypeArray> offsets;
+  offsets->SetNumberOfValues(triangleCount + 1);
+  vtkNew<vtkIdTypeArray> connectivity;
+  connectivity->SetNumberOfValues(3 * triangleCount);
+  vtkIdType* offset = offsets->GetPointer(0);
+  vtkIdType* pts = connectivity->GetPointer(0);
+  for (vtkIdType i = 0; i < triangleCount; ++i)
+    {
+    const FastQuadricSimplifier::Triangle& t = simplifier.triangles[i];
+    offset[i] = 3 * i;
+    pts[3 * i] = t.v[0];
+    pts[3 * i + 1] = t.v[1];
+    pts[3 * i + 2] = t.v[2];
+    }
+  offset[triangleCount] = 3 * triangleCount;
+  vtkNew<vtkCellArray> polys;
+  polys->SetData(offsets, connectivity);
+
+  vtkSmartPointer<vtkPolyData> polyData = vtkSmartPointer<vtkPolyData>::New();
+  polyData->SetPoints(points);
+  polyData->SetPolys(polys);
+
+  if (!source || simplifier.vertex_attribute_components == 0)
+    {
+    return polyData;
+    }
+  vtkPointData* sourcePointData = source->GetPointData();
+  vtkIdType numberOfPoints = simplifier.vertices.size();
+  const float* values = simplifier.vertex_attributes.data();
+  for (int a = 0; a < sourcePointData->GetNumberOfArrays(); ++a)
+    {
+    vtkDataArray* sourceArray = sourcePointData->GetArray(a);
+    if (!sourceArray)
+      {
+      continue;
+      }
+    vtkSmartPointer<vtkDataArray> array = vtk::TakeSmartPointer(sourceArray->NewInstance());
+    array->SetName(sourceArray->GetName());
+    int numberOfComponents = sourceArray->GetNumberOfComponents();
+    array->SetNumberOfComponents(numberOfComponents);
+    array->SetNumberOfTuples(numberOfPoints);
+    for (int c = 0; c < numberOfComponents; ++c, values += numberOfPoints)
+      {
+      switch (array->GetDataType())
+        {
+        vtkTemplateAliasMacro(FastQuadricCopyComponent(values, numberOfPoints, numberOfComponents, c,
+          static_cast<VTK_TT*>(array->GetVoidPointer(0))));
+        default:
+          for (vtkIdType i = 0; i < numberOfPoints; ++i)
+            {
+            array->SetComponent(i, c, values[i]);
+            }
+        }
+      }
+    int arrayIndex = polyData->GetPointData()->AddArray(array);
+    int attributeType = sourcePointData->IsArrayAnAttribute(a);
+    if (attributeType >= 0)
+      {
+      polyData->GetPointData()->SetActiveAttribute(arrayIndex, attributeType);
+      }
+    if (attributeType == vtkDataSetAttributes::NORMALS && numberOfComponents == 3)
+      {
+      // interpolated normals are shorter than unit length
+      double normal[3];
+      for (vtkIdType i = 0; i < numberOfPoints; ++i)
+        {
+        array->GetTuple(i, normal);
+        vtkMath::Normalize(normal);
+        array->SetTuple(i, normal);
+        }
+      }
+    }
+  return polyData;
+}
+
+#endif
@@ -0,0 +1,421 @@
+// Progressive mesh built from the edge collapses of FastQuadricSimplifier.
+//
+// The mesh is stored as the simplified (base) mesh and the sequence of
+// vertex splits that reverse the collapses, so any level of detail between
+// the base and the original mesh can be restored, and the level can be
+// changed incrementally: refining or coarsening by k splits costs O(k).
+//
+// Vertices are numbered so that the base vertices come first, followed by
+// the removed vertices in reverse order of their removal: the mesh with n
+// vertices consists of vertices 0..n-1. Each removed vertex has a parent,
+// the vertex it was merged into, which always has a smaller number.
+// Triangles are sorted by the level at which they appear (the mesh with n
+// vertices uses a prefix of them) and store their corners at that level.
+// A split lists the triangle corners that move from the parent to the new
+// vertex, and the parent position before and after the collapse.
+//
+// File format (little endian):
+//   char magic[8] = "FQPMESH1"
+//   int32 base vertex count, vertex count, base triangle count,
+//         triangle count, corner update count
+//   float32[3] position of each vertex (base vertices at the base level,
+//         split vertices when they appear)
+//   Split of each vertex after the base vertices
+//   int32[3] corners of each triangle when it appears
+//   uint32 corner update (3*triangle+corner) list of the splits
+//
+// Only the geometry is stored, point data and texture coordinates are not.
+
+#ifndef __FastQuadricProgressive_h
+#define __FastQuadricProgressive_h
+
+#include "Simplify.h"
+
+class FastQuadricProgressiveMesh
+{
+public:
+    struct Split
+    {
+        int32_t parent;             // vertex the new vertex was merged into
+        float parent_before[3];     // parent position with the new vertex
+        float parent_after[3];      // parent position without the new vertex
+        uint32_t triangle_end;      // number of triangles after the split
+        uint32_t corner_end;        // end of the corner updates of the split
+    };
+
+    int base_vertex_count = 0;
+    int base_triangle_count = 0;
+    std::vector<float> points;      // 3 per vertex
+    std::vector<Split> splits;      // splits[k] adds vertex base_vertex_count+k
+    std::vector<int32_t> triangles; // 3 per triangle
+    std::vector<uint32_t> corners;
+
+    int vertex_count() const { return int(points.size()/3); }
+    int triangle_count() const { return int(triangles.size()/3); }
+
+    // Number of triangles of the mesh with n vertices
+    int triangle_count(int n) const
+    {
+        if(n <= base_vertex_count) return base_triangle_count;
+        if(n >= vertex_count()) return triangle_count();
+        return int(splits[n-base_vertex_count-1].triangle_end);
+    }
+
+    //
+    // Building from a simplification
+    //
+    // Call set_original before simplifying the mesh with record_collapses
+    // and track_vertex_origin enabled, add_collapses after each
+    // simplification of the mesh (simplify_mesh, simplify_mesh_heap or
+    // simplify_mesh_lossless), then build.
+    //
+
+    void set_original(const FastQuadricSimplifier &simplifier)
+    {
+        original_vertex_count = simplifier.vertices.size();
+        original_triangles.resize(3*simplifier.triangles.size());
+        for(size_t i = 0; i < simplifier.triangles.size(); ++i)
+        {
+            for(int j: {0, 1, 2}) { original_triangles[3*i+j] = simplifier.triangles[i].v[j]; }
+        }
+        origin.resize(original_vertex_count);
+        for(size_t i = 0; i < origin.size(); ++i) { origin[i] = int(i); }
+        records.clear();
+    }
+
+    // Store the collapses of the last simplification with original vertex
+    // indices, and follow the renumbering of the vertices
+    bool add_collapses(const FastQuadricSimplifier &simplifier)
+    {
+        if(simplifier.vertex_origin.size() != simplifier.vertices.size())
+        {
+            printf("Progressive mesh: vertex origins were not tracked\n");
+            return false;
+        }
+        for(FastQuadricSimplifier::CollapseRecord r: simplifier.collapse_records)
+        {
+            if(r.removed < 0 || r.target < 0 || size_t(r.removed) >= origin.size() || size_t(r.target) >= origin.size())
+            {
+                printf("Progressive mesh: invalid collapse sequence\n");
+                return false;
+            }
+            r.removed = origin[r.removed];
+            r.target = origin[r.target];
+            records.push_back(r);
+        }
+        std::vector<int> remaining(simplifier.vertex_origin.size());
+        for(size_t i = 0; i < remaining.size(); ++i)
+        {
+            int v = simplifier.vertex_origin[i];
+            if(v < 0 || size_t(v) >= origin.size())
+            {
+                printf("Progressive mesh: invalid vertex origin\n");
+                return false;
+            }
+            remaining[i] = origin[v];
+        }
+        origin.swap(remaining);
+        return true;
+    }
+
+    bool build(const FastQuadricSimplifier &simplifier)
+    {
+        if(origin.size() != simplifier.vertices.size())
+        {
+            printf("Progressive mesh: collapses of the last simplification were not added\n");
+            return false;
+        }
+
+        // Vertex numbering
+        int n0 = int(simplifier.vertices.size());
+        int n = n0+int(records.size());
+        std::vector<int> id(original_vertex_count, -1);
+        base_vertex_count = n0;
+        points.resize(3*size_t(n));
+        splits.resize(records.size());
+        std::vector<int> parent(n, -1);
+        for(int i = 0; i < n0; ++i)
+        {
+            id[origin[i]] = i;
+            set_point(&points[3*size_t(i)], simplifier.vertices[i].p);
+        }
+        for(size_t k = 0; k < records.size(); ++k)
+        {
+            id[records[k].removed] = n-1-int(k);
+        }
+        for(size_t k = 0; k < records.size(); ++k)
+        {
+            const FastQuadricSimplifier::CollapseRecord &r = records[k];
+            int v = n-1-int(k);
+            Split &split = splits[v-n0];
+            split.parent = id[r.target];
+            // each vertex is removed once, into a vertex that is removed later
+            if(id[r.removed] != v || split.parent < 0 || split.parent >= v)
+            {
+                printf("Progressive mesh: invalid collapse sequence\n");
+                return false;
+            }
+            parent[v] = split.parent;
+            set_point(&points[3*size_t(v)], r.removed_p);
+            set_point(split.parent_before, r.target_before);
+            set_point(split.parent_after, r.target_after);
+        }
+
+        // Level at which each triangle appears: the vertex count at which
+        // the corners of all of its edges are separated
+        size_t triangle_n = original_triangles.size()/3;
+        std::vector<int> appear(triangle_n);
+        for(size_t i = 0; i < triangle_n; ++i)
+        {
+            int c[3];
+            for(int j: {0, 1, 2})
+            {
+                c[j] = id[original_triangles[3*i+j]];
+                if(c[j] < 0)
+                {
+                    printf("Progressive mesh: vertex of the original mesh is missing\n");
+                    return false;
+                }
+            }
+            appear[i] = std::max(n0, std::max(separation(parent, c[0], c[1]),
+                std::max(separation(parent, c[1], c[2]), separation(parent, c[2], c[0]))));
+        }
+        std::vector<int> order(triangle_n);
+        for(size_t i = 0; i < triangle_n; ++i) { order[i] = int(i); }
+        std::stable_sort(order.begin(), order.end(), [&appear](int a, int b) { return appear[a] < appear[b]; });
+
+        // Corners when the triangles appear, and the splits that change them later
+        triangles.resize(3*triangle_n);
+        std::vector<uint32_t> corner_start(splits.size()+1, 0);
+        for(int pass = 0; pass < 2; ++pass)
+        {
+            for(size_t i = 0; i < triangle_n; ++i)
+            {
+                int level = appear[order[i]];
+                for(int j: {0, 1, 2})
+                {
+                    int v = id[original_triangles[3*size_t(order[i])+j]];
+                    for(; v >= level; v = parent[v])
+                    {
+                        if(pass == 0) corner_start[v-n0+1]++;
+                        else corners[corner_start[v-n0]++] = uint32_t(3*i+j);
+                    }
+                    triangles[3*i+j] = v;
+                }
+            }
+            if(pass == 0)
+            {
+                for(size_t k = 0; k < splits.size(); ++k) { corner_start[k+1] += corner_start[k]; }
+                corners.resize(corner_start[splits.size()]);
+            }
+        }
+        // after the second pass corner_start[k] is the end of split k
+        base_triangle_count = 0;
+        size_t i = 0;
+        for(; i < triangle_n && appear[order[i]] <= n0; ++i) { base_triangle_count++; }
+        for(size_t k = 0; k < splits.size(); ++k)
+        {
+            for(; i < triangle_n && appear[order[i]] <= n0+int(k)+1; ++i) {}
+            splits[k].triangle_end = uint32_t(i);
+            splits[k].corner_end = corner_start[k];
+        }
+        reset();
+        return true;
+    }
+
+    //
+    // File IO
+    //
+
+    bool write(const char *filename) const
+    {
+        FILE *file = fopen(filename, "wb");
+        if(!file)
+        {
+            printf("write: can't write data file \"%s\".\n", filename);
+            return false;
+        }
+        int32_t header[5] = { base_vertex_count, vertex_count(), base_triangle_count, triangle_count(), int32_t(corners.size()) };
+        bool ok = fwrite(magic(), 1, 8, file) == 8
+            && fwrite(header, sizeof(header), 1, file) == 1
+            && write_array(file, points)
+            && write_array(file, splits)
+            && write_array(file, triangles)
+            && write_array(file, corners);
+        ok = (fclose(file) == 0) && ok;
+        if(!ok) printf("write: failed to write \"%s\".\n", filename);
+        return ok;
+    }
+
+    bool read(const char *filename)
+    {
+        FILE *file = fopen(filename, "rb");
+        if(!file)
+        {
+            printf("File %s not found!\n", filename);
+            return false;
+        }
+        char file_magic[8];
+        int32_t header[5];
+        bool ok = fread(file_magic, 1, 8, file) == 8 && memcmp(file_magic, magic(), 8) == 0
+            && fread(header, sizeof(header), 1, file) == 1
+            && header[0] >= 0 && header[1] >= header[0] && header[2] >= 0 && header[3] >= header[2] && header[4] >= 0;
+        if(ok)
+        {
+            base_vertex_count = header[0];
+            base_triangle_count = header[2];
+            points.resize(3*size_t(header[1]));
+            splits.resize(size_t(header[1]-header[0]));
+            triangles.resize(3*size_t(header[3]));
+            corners.resize(size_t(header[4]));
+            ok = read_array(file, points) && read_array(file, splits)
+                && read_array(file, triangles) && read_array(file, corners)
+                && valid();
+        }
+        fclose(file);
+        if(!ok)
+        {
+            printf("%s is not a valid progressive mesh file\n", filename);
+            points.clear();
+            splits.clear();
+            triangles.clear();
+            corners.clear();
+            base_vertex_count = base_triangle_count = 0;
+        }
+        reset();
+        return ok;
+    }
+
+    //
+    // Current level of detail
+    //
+    // current_points and current_triangles hold the mesh of the first
+    // current_vertex_count vertices, which uses the first
+    // triangle_count(current_vertex_count) triangles.
+    //
+
+    int current_vertex_count = 0;
+    std::vector<float> current_points;
+    std::vector<int32_t> current_triangles;
+
+    // Go to the base mesh
+    void reset()
+    {
+        current_vertex_count = base_vertex_count;
+        current_points = points;
+        current_triangles = triangles;
+    }
+
+    // Refine or coarsen to n vertices (clamped to the valid range)
+    void set_vertex_count(int n)
+    {
+        n = std::min(std::max(n, base_vertex_count), vertex_count());
+        for(; current_vertex_count < n; ++current_vertex_count)
+        {
+            int v = current_vertex_count;
+            const Split &split = splits[v-base_vertex_count];
+            std::copy(&points[3*size_t(v)], &points[3*size_t(v)]+3, &current_points[3*size_t(v)]);
+            std::copy(split.parent_before, split.parent_before+3, &current_points[3*size_t(split.parent)]);
+            for(uint32_t k = corner_begin(v); k < split.corner_end; ++k) { current_triangles[corners[k]] = v; }
+        }
+        for(; current_vertex_count > n; --current_vertex_count)
+        {
+            int v = current_vertex_count-1;
+            const Split &split = splits[v-base_vertex_count];
+            std::copy(split.parent_after, split.parent_after+3, &current_points[3*size_t(split.parent)]);
+            for(uint32_t k = corner_begin(v); k < split.corner_end; ++k) { current_triangles[corners[k]] = split.parent; }
+        }
+    }
+
+    // Go to the finest level with at most n triangles (at least the base mesh)
+    void set_triangle_count(int n)
+    {
+        int lo = base_vertex_count, hi = vertex_count();
+        while(lo < hi)
+        {
+            int mid = lo+(hi-lo+1)/2;
+            if(triangle_count(mid) <= n) lo = mid;
+            else hi = mid-1;
+        }
+        set_vertex_count(lo);
+    }
+
+protected:
+
+    size_t original_vertex_count = 0;
+    std::vector<int> original_triangles;
+    std::vector<FastQuadricSimplifier::CollapseRecord> records; // with original vertex indices
+    std::vector<int> origin; // original index of each vertex of the simplifier
+
+    static const char *magic() { return "FQPMESH1"; }
+
+    static void set_point(float *out, const vec3f &p)
+    {
+        out[0] = float(p.x);
+        out[1] = float(p.y);
+        out[2] = float(p.z);
+    }
+
+    uint32_t corner_begin(int v) const
+    {
+        return v == base_vertex_count ? 0 : splits[v-base_vertex_count-1].corner_end;
+    }
+
+    // Vertex count from which vertices a and b are not merged: they are
+    // separated as soon as one of the vertices just below their lowest
+    // common ancestor is present, 0 if they are never merged
+    static int separation(const std::vector<int> &parent, int a, int b)
+    {
+        int below_a = INT_MAX, below_b = INT_MAX;
+        while(a != b)
+        {
+            // parents have smaller numbers, so step up on the larger one
+            if(a > b)
+            {
+                below_a = a;
+                a = parent[a];
+                if(a < 0) return 0;
+            }
+            else
+            {
+                below_b = b;
+                b = parent[b];
+                if(b < 0) return 0;
+            }
+        }
+        int below = std::min(below_a, below_b);
+        return below == INT_MAX ? 0 : below+1;
+    }
+
+    bool valid() const
+    {
+        int n = vertex_count();
+        uint32_t corner_end = 0, triangle_end = uint32_t(base_triangle_count);
+        for(size_t k = 0; k < splits.size(); ++k)
+        {
+            const Split &split = splits[k];
+            if(split.parent < 0 || split.parent >= base_vertex_count+int(k)) return false;
+            if(split.corner_end < corner_end || split.corner_end > corners.size()) return false;
+            if(split.triangle_end < triangle_end || split.triangle_end > triangles.size()/3) return false;
+            corner_end = split.corner_end;
+            triangle_end = split.triangle_end;
+        }
+        for(int32_t v: triangles) { if(v < 0 || v >= n) return false; }
+        for(uint32_t c: corners) { if(c >= triangles.size()) return false; }
+        return true;
+    }
+
+    template<typename T>
+    static bool write_array(FILE *file, const std::vector<T> &a)
+    {
+        return a.empty() || fwrite(a.data(), sizeof(T), a.size(), file) == a.size();
+    }
+
+    template<typename T>
+    static bool read_array(FILE *file, std::vector<T> &a)
+    {
+        return a.empty() || fread(a.data(), sizeof(T), a.size(), file) == a.size();
+    }
+};
+
+#endif
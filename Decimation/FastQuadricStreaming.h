@@ -0,0 +1,676 @@
+// Out-of-core FastQuadric decimation of OBJ meshes that do not fit into memory.
+//
+// The OBJ file is streamed into temporary binary files and the mesh is split
+// spatially into blocks, each with at most half of the memory budget worth
+// of triangles. Each block is decimated separately with its boundary locked:
+// vertices shared with other blocks are on the boundary of the block, so
+// they are kept and the blocks are stitched together again through them.
+// Block passes are repeated with shifted block boundaries until the stitched
+// mesh fits into the memory budget, then a final pass decimates the whole
+// mesh in memory to the target triangle count.
+//
+// Besides the budget, 8 bytes per input vertex are used for the block
+// assignment. Texture coordinates and materials are not kept.
+
+#ifndef __FastQuadricStreaming_h
+#define __FastQuadricStreaming_h
+
+#include "Simplify.h"
+
+#include <stdint.h>
+
+class FastQuadricStreamingSimplifier : public FastQuadricSimplifier
+{
+public:
+    // Memory budget of the simplifier arrays in bytes
+    size_t memory_budget = size_t(1) << 30;
+
+    // Decimation method of the block passes and the final pass:
+    // simplify_mesh, simplify_mesh_heap or simplify_mesh_heap_parallel
+    enum Engine { SWEEP, HEAP, PARALLEL_HEAP };
+
+    // Number of triangles of the input mesh, set by simplify_obj
+    size_t input_triangle_count = 0;
+
+    // Approximate memory used per triangle while a mesh is simplified (a
+    // mesh has about half as many vertices as triangles and references are
+    // appended during the collapses), including the block buffers
+    static size_t bytes_per_triangle()
+    {
+        return sizeof(Triangle) + sizeof(vec3f) + 6*sizeof(Ref) + sizeof(Vertex)/2 + sizeof(TriangleRecord) + 3*sizeof(int);
+    }
+
+    //
+    // Simplify an OBJ file to round(triangles*(1-reduction)) triangles, the
+    // result is stored in the mesh of this simplifier. The settings of this
+    // simplifier (threads, constraints, error bound) are used for all
+    // passes, block passes always lock the block boundaries. Progress is
+    // reported between blocks and by the final pass, as the fraction of the
+    // whole reduction. Returns false on error or if aborted.
+    //
+
+    bool simplify_obj(const char *filename, double reduction, double agressiveness=7, Engine engine=SWEEP, bool verbose=false)
+    {
+        vertices.clear();
+        triangles.clear();
+        refs.clear();
+        mtllib.clear();
+        materials.clear();
+        normals.clear();
+        uvs.clear();
+        triangle_materials.clear();
+        vertex_attribute_components = 0;
+        vertex_attributes.clear();
+        vertex_attribute_discrete.clear();
+        aborted = false;
+
+        MeshFiles mesh;
+        if(!read_obj(filename, mesh))
+        {
+            mesh.close();
+            return false;
+        }
+        input_triangle_count = mesh.triangle_count;
+        size_t target_count = (size_t)round(mesh.triangle_count*(1.0-reduction));
+        target_triangle_count = target_count;
+        size_t capacity = std::max(memory_budget/bytes_per_triangle(), size_t(10000));
+        if(verbose)
+        {
+            printf("streaming: %zu vertices, %zu triangles, %zu triangles fit into the memory budget\n",
+                mesh.vertex_count, mesh.triangle_count, capacity);
+        }
+
+        double block_error = 0;
+        // the result is kept in memory, so a target above the budget is
+        // reached by the block passes
+        size_t block_limit = std::max(capacity, target_count);
+        for(int pass = 0; pass < max_block_passes && mesh.triangle_count > block_limit; ++pass)
+        {
+            MeshFiles stitched;
+            size_t pass_target = std::max(target_count, capacity/2);
+            if(!simplify_blocks(mesh, pass, pass_target, capacity/2, agressiveness, engine, verbose, stitched))
+            {
+                stitched.close();
+                mesh.close();
+                return false;
+            }
+            block_error = std::max(block_error, collapse_error);
+            bool reduced = stitched.triangle_count < mesh.triangle_count - mesh.triangle_count/20;
+            mesh.close();
+            mesh = stitched;
+            if(!reduced) break;
+        }
+        if(mesh.triangle_count > block_limit)
+        {
+            printf("warning: %zu triangles are left after the block passes, more than the memory budget\n", mesh.triangle_count);
+        }
+
+        // final pass on the whole mesh
+        bool loaded = load(mesh);
+        mesh.close();
+        if(!loaded) return false;
+        if(verbose)
+        {
+            printf("streaming: final pass on %zu triangles\n", triangles.size());
+        }
+        std::function<bool(const Progress&)> callback = progress_callback;
+        if(callback)
+        {
+            size_t start = triangles.size();
+            // runs after this block, so the locals are captured by value
+            progress_callback = [this, start, target_count, callback](const Progress &progress)
+            {
+                Progress overall = progress;
+                overall.fraction = reduction_fraction(start-std::max(progress.fraction, 0.0)*(double(start)-target_count));
+                return callback(overall);
+            };
+        }
+        simplify_with(*this, engine, int(target_count), agressiveness, verbose);
+        progress_callback = callback;
+        collapse_error = std::max(collapse_error, block_error);
+        return !aborted;
+    }
+
+protected:
+
+    static const int max_block_passes = 4;
+
+    size_t target_triangle_count = 0;
+
+    static void simplify_with(FastQuadricSimplifier &simplifier, Engine engine, int target_count, double agressiveness, bool verbose=false)
+    {
+        switch(engine)
+        {
+        case HEAP: simplifier.simplify_mesh_heap(target_count, verbose); break;
+        case PARALLEL_HEAP: simplifier.simplify_mesh_heap_parallel(target_count, verbose); break;
+        default: simplifier.simplify_mesh(target_count, agressiveness, verbose); break;
+        }
+    }
+
+    // Fraction of the whole reduction done when this many triangles are left
+    double reduction_fraction(double triangles_left) const
+    {
+        if(input_triangle_count <= target_triangle_count) return 1;
+        return (input_triangle_count-triangles_left)/double(input_triangle_count-target_triangle_count);
+    }
+
+    // Block assignment grid: 2^grid_bits cells along each axis
+    static const int grid_bits = 7;
+
+    struct PointRecord { double p[3]; };
+    struct TriangleRecord { int v[3]; };
+    struct BlockVertex { double p[3]; int id; };
+
+    // Mesh stored in temporary files: vertex_file holds PointRecords,
+    // triangle_file holds TriangleRecords
+    struct MeshFiles
+    {
+        FILE *vertex_file = nullptr, *triangle_file = nullptr;
+        size_t vertex_count = 0, triangle_count = 0;
+        vec3f bmin = vec3f(DBL_MAX, DBL_MAX, DBL_MAX), bmax = vec3f(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+
+        bool open()
+        {
+            vertex_file = tmpfile();
+            triangle_file = tmpfile();
+            if(!vertex_file || !triangle_file)
+            {
+                printf("Failed to create temporary files\n");
+                return false;
+            }
+            return true;
+        }
+        void close()
+        {
+            if(vertex_file) fclose(vertex_file);
+            if(triangle_file) fclose(triangle_file);
+            vertex_file = triangle_file = nullptr;
+        }
+        void add_point(const PointRecord &r)
+        {
+            bmin.x=fmin(bmin.x,r.p[0]); bmin.y=fmin(bmin.y,r.p[1]); bmin.z=fmin(bmin.z,r.p[2]);
+            bmax.x=fmax(bmax.x,r.p[0]); bmax.y=fmax(bmax.y,r.p[1]); bmax.z=fmax(bmax.z,r.p[2]);
+            vertex_count++;
+        }
+    };
+
+    static bool seek(FILE *file, uint64_t position)
+    {
+#if defined(_WIN32)
+        return _fseeki64(file, (__int64)position, SEEK_SET) == 0;
+#else
+        return fseeko(file, (off_t)position, SEEK_SET) == 0;
+#endif
+    }
+
+    // Buffered writing of records to consecutive positions of a file
+    template<typename T>
+    struct RecordWriter
+    {
+        FILE *file = nullptr;
+        uint64_t position = 0;
+        size_t capacity = 65536;
+        std::vector<T> buffer;
+        bool failed = false;
+
+        void add(const T &record)
+        {
+            buffer.push_back(record);
+            if(buffer.size() >= capacity) flush();
+        }
+        bool flush()
+        {
+            if(!buffer.empty() && !failed)
+            {
+                failed = !seek(file, position) || fwrite(buffer.data(), sizeof(T), buffer.size(), file) != buffer.size();
+                position += buffer.size()*sizeof(T);
+            }
+            buffer.clear();
+            if(failed) printf("Failed to write temporary file\n");
+            return !failed;
+        }
+    };
+
+    // Read count records starting at record first, fn(records, n, index) is
+    // called for each batch with the index of its first record
+    template<typename T, typename Function>
+    static bool read_records(FILE *file, size_t first, size_t count, Function fn)
+    {
+        if(count == 0) return true;
+        std::vector<T> batch(std::min(count, size_t(65536)));
+        if(!seek(file, uint64_t(first)*sizeof(T)))
+        {
+            printf("Failed to read temporary file\n");
+            return false;
+        }
+        for(size_t i = 0; i < count; )
+        {
+            size_t n = std::min(batch.size(), count-i);
+            if(fread(batch.data(), sizeof(T), n, file) != n)
+            {
+                printf("Failed to read temporary file\n");
+                return false;
+            }
+            fn(batch.data(), n, i);
+            i += n;
+        }
+        return true;
+    }
+
+    //
+    // Stream an OBJ file into temporary files. Only vertices and faces are
+    // read, polygons are fan-triangulated.
+    //
+
+    bool read_obj(const char *filename, MeshFiles &mesh)
+    {
+        FILE *fn;
+        if(filename==NULL || filename[0]==0) return false;
+        if((fn = fopen(filename, "rb")) == NULL)
+        {
+            printf("File %s not found!\n", filename);
+            return false;
+        }
+        if(!mesh.open())
+        {
+            fclose(fn);
+            return false;
+        }
+        RecordWriter<PointRecord> points;
+        points.file = mesh.vertex_file;
+        RecordWriter<TriangleRecord> faces;
+        faces.file = mesh.triangle_file;
+
+        const size_t block = size_t(1) << 24;
+        std::vector<char> buffer(block+2);
+        size_t size = 0;
+        int max_index = -1;
+        for(bool eof = false; !eof; )
+        {
+            if(buffer.size() < size+block+2) buffer.resize(size+block+2);
+            size_t n = fread(&buffer[size], 1, block, fn);
+            size += n;
+            eof = (n < block);
+            // parse the complete lines, keep the last incomplete one
+            size_t end = size;
+            if(eof) buffer[end++] = '\n';
+            else while(end > 0 && buffer[end-1] != '\n') end--;
+            if(end == 0) continue;
+            char next = buffer[end];
+            buffer[end] = 0;
+            const char *error = parse_obj_lines(&buffer[0], &buffer[end], mesh, points, faces, max_index);
+            if(error)
+            {
+                report_obj_error(error);
+                fclose(fn);
+                return false;
+            }
+            buffer[end] = next;
+            if(!eof)
+            {
+                memmove(&buffer[0], &buffer[end], size-end);
+                size -= end;
+            }
+        }
+        fclose(fn);
+        if(max_index >= (int)mesh.vertex_count)
+        {
+            printf("Face refers to vertex %d, but there are only %zu vertices\n", max_index+1, mesh.vertex_count);
+            return false;
+        }
+        return points.flush() && faces.flush();
+    }
+
+    const char *parse_obj_lines(const char *begin, const char *end, MeshFiles &mesh,
+        RecordWriter<PointRecord> &points, RecordWriter<TriangleRecord> &faces, int &max_index)
+    {
+        for(const char *line = begin; line < end; line = next_line(line))
+        {
+            const char *s = skip_blank(line);
+            if(s[0] == 'v' && is_blank(s[1]))
+            {
+                PointRecord r;
+                s = skip_blank(s+1);
+                if(!parse_double(s, r.p[0])) return line;
+                s = skip_blank(s);
+                if(!parse_double(s, r.p[1])) return line;
+                s = skip_blank(s);
+                if(!parse_double(s, r.p[2])) return line;
+                points.add(r);
+                mesh.add_point(r);
+            }
+            else if(s[0] == 'f' && is_blank(s[1]))
+            {
+                TriangleRecord t;
+                int corner = 0;
+                for(s = skip_blank(s+1); !is_line_end(*s) && *s != '#'; s = skip_blank(s), corner++)
+                {
+                    int k = std::min(corner, 2);
+                    int index;
+                    if(!parse_int(s, index) || !resolve_index(index, mesh.vertex_count, INT_MAX, t.v[k])) return line;
+                    // texture coordinate and normal indices are not used
+                    while(*s == '/' || *s == '-' || (*s >= '0' && *s <= '9')) s++;
+                    if(!is_blank(*s) && !is_line_end(*s) && *s != '#') return line;
+                    max_index = std::max(max_index, t.v[k]);
+                    if(corner < 2) continue;
+                    faces.add(t);
+                    mesh.triangle_count++;
+                    // next triangle of the fan
+                    t.v[1] = t.v[2];
+                }
+                if(corner < 3) return line;
+            }
+        }
+        return nullptr;
+    }
+
+    // Load a mesh from temporary files into this simplifier
+
+    bool load(const MeshFiles &mesh)
+    {
+        vertices.resize(mesh.vertex_count);
+        triangles.resize(mesh.triangle_count);
+        return read_records<PointRecord>(mesh.vertex_file, 0, mesh.vertex_count,
+            [&](const PointRecord *r, size_t n, size_t first)
+            {
+                for(size_t i = 0; i < n; ++i) { vertices[first+i].p = vec3f(r[i].p[0], r[i].p[1], r[i].p[2]); }
+            })
+            && read_records<TriangleRecord>(mesh.triangle_file, 0, mesh.triangle_count,
+            [&](const TriangleRecord *r, size_t n, size_t first)
+            {
+                for(size_t i = 0; i < n; ++i)
+                {
+                    Triangle &t = triangles[first+i];
+                    for(int j: {0, 1, 2}) { t.v[j] = r[i].v[j]; }
+                    t.deleted = 0;
+                    t.dirty = 0;
+                    t.attr = 0;
+                }
+            });
+    }
+
+    //
+    // One block pass
+    //
+    // Vertices are labeled by the cell of a grid that contains them, the
+    // cells are grouped along the Morton curve into blocks of at most
+    // block_capacity triangles, and each triangle belongs to the block of
+    // its first vertex. The grid is shifted (cyclically) in each pass, so
+    // that boundaries of the previous pass get decimated. Vertices used by
+    // several blocks are written first to the stitched mesh, then each
+    // block appends its remaining vertices and triangles.
+    //
+
+    bool simplify_blocks(const MeshFiles &in, int pass, size_t pass_target, size_t block_capacity,
+        double agressiveness, Engine engine, bool verbose, MeshFiles &out)
+    {
+        const int grid = 1 << grid_bits;
+        const int shift = (pass*(grid/3+5)) % grid;
+        vec3f cell = (in.bmax-in.bmin)/double(grid);
+        if(!(cell.x > 0)) cell.x = 1;
+        if(!(cell.y > 0)) cell.y = 1;
+        if(!(cell.z > 0)) cell.z = 1;
+        auto morton = [&](const PointRecord &r)
+        {
+            int c[3] = { int((r.p[0]-in.bmin.x)/cell.x), int((r.p[1]-in.bmin.y)/cell.y), int((r.p[2]-in.bmin.z)/cell.z) };
+            int code = 0;
+            for(int j = 0; j < 3; ++j)
+            {
+                int x = (std::min(std::max(c[j], 0), grid-1) + shift) & (grid-1);
+                for(int b = 0; b < grid_bits; ++b) { code |= ((x >> b) & 1) << (3*b+j); }
+            }
+            return code;
+        };
+
+        // Triangles per cell, then the cells are grouped into blocks
+        std::vector<int> vertex_block(in.vertex_count);
+        if(!read_records<PointRecord>(in.vertex_file, 0, in.vertex_count,
+            [&](const PointRecord *r, size_t n, size_t first) { for(size_t i = 0; i < n; ++i) { vertex_block[first+i] = morton(r[i]); } }))
+        {
+            return false;
+        }
+        std::vector<size_t> cell_block(size_t(1) << (3*grid_bits), 0);
+        if(!read_records<TriangleRecord>(in.triangle_file, 0, in.triangle_count,
+            [&](const TriangleRecord *r, size_t n, size_t) { for(size_t i = 0; i < n; ++i) { cell_block[vertex_block[r[i].v[0]]]++; } }))
+        {
+            return false;
+        }
+        int block_count = 0;
+        size_t block_size = 0;
+        for(size_t &c: cell_block)
+        {
+            size_t count = c;
+            if(block_size > 0 && block_size+count > block_capacity)
+            {
+                block_count++;
+                block_size = 0;
+            }
+            block_size += count;
+            c = block_count;
+        }
+        block_count++;
+        for(int &b: vertex_block) { b = int(cell_block[b]); }
+        std::vector<size_t>().swap(cell_block);
+
+        // Sort the triangles by block and find the vertices shared by blocks
+        std::vector<size_t> triangle_start(block_count+1, 0);
+        std::vector<int> vertex_use(in.vertex_count, -1); // block, or -2 if shared
+        if(!read_records<TriangleRecord>(in.triangle_file, 0, in.triangle_count,
+            [&](const TriangleRecord *r, size_t n, size_t)
+            {
+                for(size_t i = 0; i < n; ++i)
+                {
+                    int b = vertex_block[r[i].v[0]];
+                    triangle_start[b+1]++;
+                    for(int j: {0, 1, 2})
+                    {
+                        int &use = vertex_use[r[i].v[j]];
+                        use = (use == -1 || use == b) ? b : -2;
+                    }
+                }
+            }))
+        {
+            return false;
+        }
+        for(int b = 0; b < block_count; ++b) { triangle_start[b+1] += triangle_start[b]; }
+        FILE *block_triangles = tmpfile();
+        FILE *block_vertices = tmpfile();
+        auto close_block_files = [&]()
+        {
+            if(block_triangles) fclose(block_triangles);
+            if(block_vertices) fclose(block_vertices);
+        };
+        if(!block_triangles || !block_vertices)
+        {
+            printf("Failed to create temporary files\n");
+            close_block_files();
+            return false;
+        }
+        // write buffers use an eighth of the budget
+        size_t buffer_capacity = std::min(std::max(memory_budget/8/(block_count*sizeof(BlockVertex)), size_t(256)), size_t(65536));
+        bool written = true;
+        {
+            std::vector<RecordWriter<TriangleRecord>> writers(block_count);
+            for(int b = 0; b < block_count; ++b)
+            {
+                writers[b].file = block_triangles;
+                writers[b].position = triangle_start[b]*sizeof(TriangleRecord);
+                writers[b].capacity = buffer_capacity;
+            }
+            written = read_records<TriangleRecord>(in.triangle_file, 0, in.triangle_count,
+                [&](const TriangleRecord *r, size_t n, size_t) { for(size_t i = 0; i < n; ++i) { writers[vertex_block[r[i].v[0]]].add(r[i]); } });
+            for(RecordWriter<TriangleRecord> &w: writers) { written = w.flush() && written; }
+        }
+        std::vector<int>().swap(vertex_block);
+
+        // Shared vertices are kept in memory, the others are sorted by block
+        std::vector<size_t> vertex_start(block_count+1, 0);
+        std::vector<int> shared_ids;
+        std::vector<PointRecord> shared_points;
+        for(int use: vertex_use)
+        {
+            if(use >= 0) vertex_start[use+1]++;
+        }
+        for(int b = 0; b < block_count; ++b) { vertex_start[b+1] += vertex_start[b]; }
+        if(written)
+        {
+            std::vector<RecordWriter<BlockVertex>> writers(block_count);
+            for(int b = 0; b < block_count; ++b)
+            {
+                writers[b].file = block_vertices;
+                writers[b].position = vertex_start[b]*sizeof(BlockVertex);
+                writers[b].capacity = buffer_capacity;
+            }
+            written = read_records<PointRecord>(in.vertex_file, 0, in.vertex_count,
+                [&](const PointRecord *r, size_t n, size_t first)
+                {
+                    for(size_t i = 0; i < n; ++i)
+                    {
+                        int use = vertex_use[first+i];
+                        if(use >= 0)
+                        {
+                            BlockVertex v = { { r[i].p[0], r[i].p[1], r[i].p[2] }, int(first+i) };
+                            writers[use].add(v);
+                        }
+                        else if(use == -2)
+                        {
+                            shared_ids.push_back(int(first+i));
+                            shared_points.push_back(r[i]);
+                        }
+                    }
+                });
+            for(RecordWriter<BlockVertex> &w: writers) { written = w.flush() && written; }
+        }
+        std::vector<int>().swap(vertex_use);
+        if(!written || !out.open())
+        {
+            close_block_files();
+            return false;
+        }
+
+        // Shared vertices are the first vertices of the stitched mesh
+        RecordWriter<PointRecord> out_points;
+        out_points.file = out.vertex_file;
+        RecordWriter<TriangleRecord> out_triangles;
+        out_triangles.file = out.triangle_file;
+        for(const PointRecord &r: shared_points)
+        {
+            out_points.add(r);
+            out.add_point(r);
+        }
+        if(verbose)
+        {
+            printf("block pass %d: %d blocks, %zu shared vertices\n", pass, block_count, shared_ids.size());
+        }
+
+        FastQuadricSimplifier simplifier;
+        if(!thread_pool && thread_count() > 1) thread_pool = std::make_shared<FastQuadricThreadPool>(thread_count());
+        simplifier.threads = threads;
+        simplifier.thread_pool = thread_pool;
+        simplifier.deterministic = deterministic;
+        simplifier.border_weight = border_weight;
+        simplifier.feature_angle = feature_angle;
+        simplifier.feature_weight = feature_weight;
+        simplifier.max_error = max_error;
+        simplifier.lock_border = true;
+        simplifier.track_vertex_origin = true;
+        collapse_error = 0;
+        std::vector<TriangleRecord> block_faces;
+        std::vector<BlockVertex> block_points;
+        std::vector<int> ids, out_ids;
+        for(int b = 0; b < block_count && written; ++b)
+        {
+            size_t triangle_count = triangle_start[b+1]-triangle_start[b];
+            size_t vertex_count = vertex_start[b+1]-vertex_start[b];
+            if(triangle_count == 0) continue;
+            size_t triangles_left = out.triangle_count+in.triangle_count-triangle_start[b];
+            if(!report_progress(reduction_fraction(double(triangles_left)), pass, int(triangles_left), 0))
+            {
+                written = false;
+                break;
+            }
+            block_faces.resize(triangle_count);
+            block_points.resize(vertex_count);
+            if(!read_records<TriangleRecord>(block_triangles, triangle_start[b], triangle_count,
+                [&](const TriangleRecord *r, size_t n, size_t first) { std::copy(r, r+n, &block_faces[first]); })
+                || !read_records<BlockVertex>(block_vertices, vertex_start[b], vertex_count,
+                [&](const BlockVertex *r, size_t n, size_t first) { std::copy(r, r+n, &block_points[first]); }))
+            {
+                written = false;
+                break;
+            }
+
+            // Local vertex index: position in the sorted list of used vertices
+            ids.clear();
+            for(const TriangleRecord &t: block_faces) { ids.insert(ids.end(), t.v, t.v+3); }
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            simplifier.vertices.resize(ids.size());
+            size_t own = 0;
+            for(size_t i = 0; i < ids.size(); ++i)
+            {
+                // vertices of the block are sorted by id as well
+                const double *p;
+                if(own < block_points.size() && block_points[own].id == ids[i])
+                {
+                    p = block_points[own++].p;
+                }
+                else
+                {
+                    p = shared_points[std::lower_bound(shared_ids.begin(), shared_ids.end(), ids[i])-shared_ids.begin()].p;
+                }
+                simplifier.vertices[i].p = vec3f(p[0], p[1], p[2]);
+            }
+            simplifier.triangles.resize(triangle_count);
+            for(size_t i = 0; i < triangle_count; ++i)
+            {
+                Triangle &t = simplifier.triangles[i];
+                for(int j: {0, 1, 2}) { t.v[j] = int(std::lower_bound(ids.begin(), ids.end(), block_faces[i].v[j])-ids.begin()); }
+                t.deleted = 0;
+                t.dirty = 0;
+                t.attr = 0;
+            }
+
+            int block_target = int(round(double(triangle_count)*pass_target/in.triangle_count));
+            simplify_with(simplifier, engine, block_target, agressiveness);
+            collapse_error = std::max(collapse_error, simplifier.collapse_error);
+
+            // Append the block to the stitched mesh
+            out_ids.resize(simplifier.vertices.size());
+            for(size_t i = 0; i < simplifier.vertices.size(); ++i)
+            {
+                int id = ids[simplifier.vertex_origin[i]];
+                std::vector<int>::iterator shared = std::lower_bound(shared_ids.begin(), shared_ids.end(), id);
+                if(shared != shared_ids.end() && *shared == id)
+                {
+                    out_ids[i] = int(shared-shared_ids.begin());
+                    continue;
+                }
+                const vec3f &p = simplifier.vertices[i].p;
+                PointRecord r = { { p.x, p.y, p.z } };
+                out_ids[i] = int(out.vertex_count);
+                out_points.add(r);
+                out.add_point(r);
+            }
+            for(const Triangle &t: simplifier.triangles)
+            {
+                TriangleRecord r = { { out_ids[t.v[0]], out_ids[t.v[1]], out_ids[t.v[2]] } };
+                out_triangles.add(r);
+                out.triangle_count++;
+            }
+            if(verbose)
+            {
+                printf("block %d: %zu -> %zu triangles\n", b, triangle_count, simplifier.triangles.size());
+            }
+        }
+        close_block_files();
+        written = out_points.flush() && out_triangles.flush() && written;
+        if(verbose)
+        {
+            printf("block pass %d: %zu -> %zu triangles\n", pass, in.triangle_count, out.triangle_count);
+        }
+        return written;
+    }
+};
+
+#endif
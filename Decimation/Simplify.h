@@ -10,6 +10,13 @@
 //https://github.com/sp4cerat/Fast-Quadric-Mesh-Simplification
 //
 // 5/2016: Chris Rorden created minimal version for OSX/Linux/Windows compile
+//
+// The mesh is owned by a FastQuadricSimplifier instance (instead of namespace
+// level globals) so that several meshes can be decimated concurrently within
+// one process.
+
+#ifndef __Simplify_h
+#define __Simplify_h
 
 //#include <iostream>
 //#include <stddef.h>
@@ -17,7 +24,7 @@
 //#include <sys/stat.h>
 //#include <stdbool.h>
 #include <string.h>
-//#include <ctype.h>
+#include <ctype.h>
 //#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,6 +33,15 @@
 #include <string>
 #include <math.h>
 #include <float.h> //FLT_EPSILON, DBL_EPSILON
+#include <limits.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 
 
 struct vector3
@@ -206,7 +222,7 @@ struct vec3f
 
 };
 
-vec3f barycentric(const vec3f &p, const vec3f &a, const vec3f &b, const vec3f &c){
+inline vec3f barycentric(const vec3f &p, const vec3f &a, const vec3f &b, const vec3f &c){
     vec3f v0 = b-a;
     vec3f v1 = c-a;
     vec3f v2 = p-a;
@@ -222,7 +238,7 @@ vec3f barycentric(const vec3f &p, const vec3f &a, const vec3f &b, const vec3f &c
     return vec3f(u,v,w);
 }
 
-vec3f interpolate(const vec3f &p, const vec3f &a, const vec3f &b, const vec3f &c, const vec3f attrs[3])
+inline vec3f interpolate(const vec3f &p, const vec3f &a, const vec3f &b, const vec3f &c, const vec3f attrs[3])
 {
     vec3f bary = barycentric(p,a,b,c);
     vec3f out = vec3f(0,0,0);
@@ -232,12 +248,112 @@ vec3f interpolate(const vec3f &p, const vec3f &a, const vec3f &b, const vec3f &c
     return out;
 }
 
-double min(double v1, double v2) {
+inline double min(double v1, double v2) {
     return fmin(v1,v2);
 }
 
 
-class SymetricMatrix {
+//
+// SIMD support
+//
+// Quadric addition and the batched edge error computation use AVX or SSE2
+// instructions when the compiler targets them, with a scalar fallback.
+// All variants perform the same floating point operations in the same
+// order. The results may still differ in the last bits between builds for
+// different instruction sets: compilers may fuse multiplications and
+// additions of the scalar code into FMA instructions (the default of GCC
+// and Clang on AArch64, or on x86 with -mfma), which the SSE2 and AVX
+// intrinsics never do.
+//
+
+#if defined(__AVX__)
+#define SIMPLIFY_USE_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMPLIFY_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Four doubles processed together
+struct dvec4
+{
+#if defined(SIMPLIFY_USE_AVX)
+    __m256d v;
+    static dvec4 make(__m256d a) { dvec4 r; r.v = a; return r; }
+    static dvec4 set(double a, double b, double c, double d) { return make(_mm256_setr_pd(a, b, c, d)); }
+    void store(double *out) const { _mm256_storeu_pd(out, v); }
+    dvec4 operator+(const dvec4 &o) const { return make(_mm256_add_pd(v, o.v)); }
+    dvec4 operator-(const dvec4 &o) const { return make(_mm256_sub_pd(v, o.v)); }
+    dvec4 operator*(const dvec4 &o) const { return make(_mm256_mul_pd(v, o.v)); }
+    dvec4 operator/(const dvec4 &o) const { return make(_mm256_div_pd(v, o.v)); }
+    dvec4 operator-() const { return make(_mm256_xor_pd(v, _mm256_set1_pd(-0.0))); }
+#elif defined(SIMPLIFY_USE_SSE2)
+    __m128d lo, hi;
+    static dvec4 make(__m128d a, __m128d b) { dvec4 r; r.lo = a; r.hi = b; return r; }
+    static dvec4 set(double a, double b, double c, double d) { return make(_mm_setr_pd(a, b), _mm_setr_pd(c, d)); }
+    void store(double *out) const { _mm_storeu_pd(out, lo); _mm_storeu_pd(out+2, hi); }
+    dvec4 operator+(const dvec4 &o) const { return make(_mm_add_pd(lo, o.lo), _mm_add_pd(hi, o.hi)); }
+    dvec4 operator-(const dvec4 &o) const { return make(_mm_sub_pd(lo, o.lo), _mm_sub_pd(hi, o.hi)); }
+    dvec4 operator*(const dvec4 &o) const { return make(_mm_mul_pd(lo, o.lo), _mm_mul_pd(hi, o.hi)); }
+    dvec4 operator/(const dvec4 &o) const { return make(_mm_div_pd(lo, o.lo), _mm_div_pd(hi, o.hi)); }
+    dvec4 operator-() const { __m128d sign = _mm_set1_pd(-0.0); return make(_mm_xor_pd(lo, sign), _mm_xor_pd(hi, sign)); }
+#else
+    double d[4];
+    static dvec4 set(double a, double b, double c, double e) { dvec4 r; r.d[0] = a; r.d[1] = b; r.d[2] = c; r.d[3] = e; return r; }
+    void store(double *out) const { for (int i = 0; i < 4; ++i) { out[i] = d[i]; } }
+    dvec4 operator+(const dvec4 &o) const { dvec4 r; for (int i = 0; i < 4; ++i) { r.d[i] = d[i] + o.d[i]; } return r; }
+    dvec4 operator-(const dvec4 &o) const { dvec4 r; for (int i = 0; i < 4; ++i) { r.d[i] = d[i] - o.d[i]; } return r; }
+    dvec4 operator*(const dvec4 &o) const { dvec4 r; for (int i = 0; i < 4; ++i) { r.d[i] = d[i] * o.d[i]; } return r; }
+    dvec4 operator/(const dvec4 &o) const { dvec4 r; for (int i = 0; i < 4; ++i) { r.d[i] = d[i] / o.d[i]; } return r; }
+    dvec4 operator-() const { dvec4 r; for (int i = 0; i < 4; ++i) { r.d[i] = -d[i]; } return r; }
+#endif
+    static dvec4 broadcast(double a) { return set(a, a, a, a); }
+};
+
+inline dvec4 operator*(double a, const dvec4 &b) { return dvec4::broadcast(a) * b; }
+inline dvec4 operator/(double a, const dvec4 &b) { return dvec4::broadcast(a) / b; }
+
+//
+// Quadric math on double or dvec4 (one quadric per lane)
+//
+
+// Determinant of a 3x3 matrix
+template<typename T>
+inline T det3(const T &a11, const T &a12, const T &a13,
+              const T &a21, const T &a22, const T &a23,
+              const T &a31, const T &a32, const T &a33)
+{
+    return a11*a22*a33 + a13*a21*a32 + a12*a23*a31
+         - a13*a22*a31 - a11*a23*a32 - a12*a21*a33;
+}
+
+// Determinant of the 3x3 part of quadric q
+template<typename T>
+inline T quadric_det(const T *q)
+{
+    return det3(q[0], q[1], q[2], q[1], q[4], q[5], q[2], q[5], q[7]);
+}
+
+// Position of minimum error of quadric q (det is the value of quadric_det)
+template<typename T>
+inline void quadric_solve(const T *q, const T &det, T &x, T &y, T &z)
+{
+    // -1/det is exactly -(1/det), so one division is enough
+    T inv = 1/det;
+    x = -inv*(det3(q[1], q[2], q[3], q[4], q[5], q[6], q[5], q[7], q[8]));    // vx = A41/det(q_delta)
+    y =  inv*(det3(q[0], q[2], q[3], q[1], q[5], q[6], q[2], q[7], q[8]));    // vy = A42/det(q_delta)
+    z = -inv*(det3(q[0], q[1], q[3], q[1], q[4], q[6], q[2], q[5], q[8]));    // vz = A43/det(q_delta)
+}
+
+// Error of a position for quadric q
+template<typename T>
+inline T quadric_error(const T *q, const T &x, const T &y, const T &z)
+{
+    return   q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x + q[4]*y*y
+         + 2*q[5]*y*z + 2*q[6]*y + q[7]*z*z + 2*q[8]*z + q[9];
+}
+
+class alignas(16) SymetricMatrix {
 
     public:
 
@@ -267,30 +383,29 @@ class SymetricMatrix {
 
     double operator[](int c) const { return m[c]; }
 
-    // Determinant
-
-    double det(    int a11, int a12, int a13,
-                int a21, int a22, int a23,
-                int a31, int a32, int a33)
-    {
-        double det =  m[a11]*m[a22]*m[a33] + m[a13]*m[a21]*m[a32] + m[a12]*m[a23]*m[a31]
-                    - m[a13]*m[a22]*m[a31] - m[a11]*m[a23]*m[a32]- m[a12]*m[a21]*m[a33];
-        return det;
-    }
-
     const SymetricMatrix operator+(const SymetricMatrix& n) const
     {
-        return SymetricMatrix( m[0]+n[0],   m[1]+n[1],   m[2]+n[2],   m[3]+n[3],
-                                            m[4]+n[4],   m[5]+n[5],   m[6]+n[6],
-                                                         m[ 7]+n[ 7], m[ 8]+n[8 ],
-                                                                      m[ 9]+n[9 ]);
+        SymetricMatrix r(*this);
+        r += n;
+        return r;
     }
 
     SymetricMatrix& operator+=(const SymetricMatrix& n)
     {
+#if defined(SIMPLIFY_USE_AVX)
+        _mm256_storeu_pd(m,   _mm256_add_pd(_mm256_loadu_pd(m),   _mm256_loadu_pd(n.m)));
+        _mm256_storeu_pd(m+4, _mm256_add_pd(_mm256_loadu_pd(m+4), _mm256_loadu_pd(n.m+4)));
+        _mm_store_pd(m+8, _mm_add_pd(_mm_load_pd(m+8), _mm_load_pd(n.m+8)));
+#elif defined(SIMPLIFY_USE_SSE2)
+        for (int i = 0; i < 10; i += 2)
+        {
+            _mm_store_pd(m+i, _mm_add_pd(_mm_load_pd(m+i), _mm_load_pd(n.m+i)));
+        }
+#else
          m[0]+=n[0];   m[1]+=n[1];   m[2]+=n[2];   m[3]+=n[3];
          m[4]+=n[4];   m[5]+=n[5];   m[6]+=n[6];   m[7]+=n[7];
          m[8]+=n[8];   m[9]+=n[9];
+#endif
         return *this;
     }
 
@@ -298,33 +413,248 @@ class SymetricMatrix {
 };
 ///////////////////////////////////////////
 
-namespace Simplify
+// Fixed set of worker threads that are started once and reused by every
+// parallel pass, so that short passes (e.g. update_mesh every few iterations)
+// do not pay for creating and joining threads.
+// A pool can be shared by several simplifiers, jobs are run one at a time.
+
+class FastQuadricThreadPool
+{
+public:
+    explicit FastQuadricThreadPool(int thread_count)
+    {
+        for(int i = 1; i < thread_count; ++i) { workers.emplace_back([this]() { worker_loop(); }); }
+    }
+
+    ~FastQuadricThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(std::thread& w: workers) { w.join(); }
+    }
+
+    FastQuadricThreadPool(const FastQuadricThreadPool&) = delete;
+    FastQuadricThreadPool& operator=(const FastQuadricThreadPool&) = delete;
+
+    // Number of threads, including the thread calling run()
+    int size() const { return (int)workers.size()+1; }
+
+    // Run fn(0) .. fn(task_count-1) on the pool and the calling thread and
+    // wait for completion. Calls from within a task are run inline.
+    void run(int task_count, const std::function<void(int)> &fn)
+    {
+        if(inside_task() || workers.empty())
+        {
+            for(int i = 0; i < task_count; ++i) { fn(i); }
+            return;
+        }
+        std::lock_guard<std::mutex> run_lock(run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            job_tasks = task_count;
+            next_task = 0;
+            pending = task_count;
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    static bool &inside_task()
+    {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    // Take tasks of the current job until none are left
+    void work()
+    {
+        for(;;)
+        {
+            const std::function<void(int)> *fn;
+            int task;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!job || next_task >= job_tasks) return;
+                fn = job;
+                task = next_task++;
+            }
+            inside_task() = true;
+            (*fn)(task);
+            inside_task() = false;
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--pending == 0) done.notify_all();
+        }
+    }
+
+    void worker_loop()
+    {
+        unsigned seen = 0;
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if(stopping) return;
+                seen = generation;
+            }
+            work();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int)> *job = nullptr;
+    int job_tasks = 0;
+    int next_task = 0;
+    int pending = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+};
+///////////////////////////////////////////
+
+class FastQuadricSimplifier
 {
-    // Global Variables & Strctures
+public:
     enum Attributes {
         NONE,
         NORMAL = 2,
         TEXCOORD = 4,
         COLOR = 8
     };
-    struct Triangle { int v[3];double err[4];int deleted,dirty,attr;vec3f n;vec3f uvs[3];int material; };
-    struct Vertex { vec3f p;int tstart; size_t tcount;SymetricMatrix q;int border;};
+    // Only the fields used by the collapse loops are stored in Triangle,
+    // everything else is in per-triangle side arrays indexed by triangle id
+    struct Triangle { double err[4];int v[3];unsigned char deleted,dirty,attr; };
+    struct TexCoords { vec3f uv[3]; };
+    struct Vertex { SymetricMatrix q;vec3f p;int tstart,border; size_t tcount;};
     struct Ref { int tid,tvertex; };
+
+    // Mesh owned by this instance
     std::vector<Triangle> triangles;
     std::vector<Vertex> vertices;
     std::vector<Ref> refs;
     std::string mtllib;
     std::vector<std::string> materials;
 
-    // Helper functions
+    // Per-triangle side arrays
+    std::vector<vec3f> normals; // computed by update_mesh(0)
+    std::vector<TexCoords> uvs; // empty if there are no texture coordinates
+    std::vector<int> triangle_materials; // empty if no material is used
+
+    // Per-vertex attributes (e.g. point data arrays of a VTK mesh), stored
+    // component by component: component c of vertex i is
+    // vertex_attributes[c*vertices.size()+i]. When an edge is collapsed the
+    // attributes of the remaining vertex are interpolated along the edge,
+    // at the projection of the new vertex position.
+    int vertex_attribute_components = 0;
+    std::vector<float> vertex_attributes;
+    // Components holding labels (e.g. integer point data arrays), which are
+    // not interpolated: the remaining vertex of a collapse keeps its value,
+    // and a cluster gets the value of its first vertex. Empty if all
+    // components are interpolated.
+    std::vector<char> vertex_attribute_discrete;
+
+    // If enabled, compact_mesh stores the index that each remaining vertex
+    // had before the simplification in vertex_origin
+    bool track_vertex_origin = false;
+    std::vector<int> vertex_origin;
+
+    // If enabled, the edge collapses of simplify_mesh, simplify_mesh_heap
+    // and simplify_mesh_lossless are stored in collapse_records, in the
+    // order they were performed. Vertex indices refer to the mesh before
+    // the simplification. Collapses of a parallel pass are stored cell by
+    // cell, they touch separate parts of the mesh, so the order is valid.
+    // A vertex that loses all of its triangles in a collapse is recorded as
+    // merged into the remaining vertex, which does not move.
+    struct CollapseRecord
+    {
+        int removed, target;  // vertex removed by the collapse, and the one it was merged into
+        vec3f removed_p;      // position of the removed vertex
+        vec3f target_before;  // position of the remaining vertex before the collapse
+        vec3f target_after;   // ... and after the collapse
+    };
+    bool record_collapses = false;
+    std::vector<CollapseRecord> collapse_records;
+
+    // Number of threads used by simplify_mesh (0 = all available cores).
+    // With more than one thread each iteration collapses the edges of
+    // spatially separated parts of the mesh concurrently, and update_mesh
+    // computes quadrics, edge errors and references in parallel.
+    int threads = 1;
+
+    // Worker threads, created with thread_count() threads on first use if
+    // not set. Assign a pool to share the threads between simplifiers.
+    std::shared_ptr<FastQuadricThreadPool> thread_pool;
+
+    // If enabled (default) the parallel collapse pass gives identical results
+    // regardless of the number of threads and their scheduling. If disabled
+    // then threads share a common stop counter, which allows reaching the
+    // target triangle count with fewer iterations.
+    bool deterministic = true;
+
+    // Boundary and feature preservation
+    //
+    // border_weight  : weight of the constraint planes of border edges,
+    //                  which penalize moving border vertices away from the
+    //                  border (0 = no constraint planes)
+    // lock_border    : border vertices are not moved or removed at all
+    // feature_angle  : edges where the angle between the triangle normals
+    //                  exceeds this (in degrees) are feature edges
+    //                  (0 = no feature edges)
+    // feature_weight : weight of the constraint planes of feature edges
+    double border_weight = 0;
+    bool lock_border = false;
+    double feature_angle = 0;
+    double feature_weight = 1000;
+
+    // Error bound. If positive, an edge is only collapsed if its quadric
+    // error (sum of squared distances of the new vertex from the planes
+    // accumulated in the quadric) is at most max_error^2, so the vertices
+    // stay within max_error of the planes of the triangles they replace.
+    // simplify_mesh and simplify_mesh_heap then stop when no edge within
+    // the bound is left, even if the target count is not reached.
+    double max_error = 0;
+
+    // If enabled, edge collapses preserve the volume enclosed by the surface
+    // (as VolumePreservation of vtkQuadricDecimation): the new vertex is the
+    // minimum of the quadric error on the plane where the signed volume
+    // swept by the triangles around the edge is zero (Lindstrom-Turk).
+    bool volume_preservation = false;
+
+    // Largest quadric error of the collapses of the last simplification,
+    // as a distance (square root of the quadric error)
+    double collapse_error = 0;
+
+    // Progress reporting and cancellation
+    //
+    // If set, progress_callback is called once per iteration of
+    // simplify_mesh, every progress_interval collapses of simplify_mesh_heap
+    // and simplify_mesh_lossless, and once before the clusters are
+    // merged by simplify_mesh_clustering. If it returns false the
+    // simplification stops and aborted is set, the mesh is left partially
+    // simplified (but valid).
+    struct Progress
+    {
+        double fraction;   // estimated fraction of the work done, negative if unknown (lossless)
+        int iteration;     // iteration, or number of collapses for simplify_mesh_heap and simplify_mesh_lossless
+        int triangles;     // current number of triangles
+        double threshold;  // current error threshold
+    };
+    std::function<bool(const Progress&)> progress_callback;
+    int progress_interval = 10000;
+    bool aborted = false;
 
-    double vertex_error(SymetricMatrix q, double x, double y, double z);
-    double calculate_error(int id_v1, int id_v2, vec3f &p_result);
-    bool flipped(vec3f p,int i0,int i1,Vertex &v0,Vertex &v1,std::vector<int> &deleted);
-    void update_uvs(int i0,const Vertex &v,const vec3f &p,std::vector<int> &deleted);
-    void update_triangles(int i0,Vertex &v,std::vector<int> &deleted,int &deleted_triangles);
-    void update_mesh(int iteration);
-    void compact_mesh();
     //
     // Main simplification function
     //
@@ -341,8 +671,11 @@ namespace Simplify
 
         // main iteration loop
         int deleted_triangles=0;
-        std::vector<int> deleted0,deleted1;
+        CollapseScratch scratch;
         int triangle_count=triangles.size();
+        bool serial_only=false;
+        aborted=false;
+        collapse_records.clear();
         //int iteration = 0;
         //loop(iteration,0,100)
         for (int iteration = 0; iteration < 100; iteration ++)
@@ -352,7 +685,7 @@ namespace Simplify
             // update mesh once in a while
             if(iteration%5==0)
             {
-                update_mesh(iteration);
+                update_mesh(iteration, verbose);
             }
 
             // clear dirty flag
@@ -365,698 +698,2493 @@ namespace Simplify
             // If it does not, try to adjust the 3 parameters
             //
             double threshold = 0.000000001*pow(double(iteration+3),agressiveness);
+            bool bounded = max_error > 0 && threshold >= max_error*max_error;
+            if (bounded) threshold = max_error*max_error;
 
             // target number of triangles reached ? Then break
             if ((verbose) && (iteration%5==0)) {
                 printf("iteration %d - triangles %d threshold %g\n",iteration,triangle_count-deleted_triangles, threshold);
             }
+            if (!report_progress(double(deleted_triangles)/(triangle_count-target_count), iteration, triangle_count-deleted_triangles, threshold)) break;
 
             // remove vertices & mark deleted triangles
+            int remaining = triangle_count-deleted_triangles-target_count;
+            int deleted_before = deleted_triangles;
+            if (!serial_only && thread_count() > 1 && remaining >= (triangle_count-deleted_triangles)/50
+                && triangle_count-deleted_triangles >= parallel_min_triangles)
+            {
+                deleted_triangles += collapse_parallel(iteration, threshold, remaining, scratch.max_collapse_error);
+                // edges crossing cell boundaries may still be collapsible
+                serial_only = bounded && deleted_triangles == deleted_before;
+                continue;
+            }
             for(Triangle& t: triangles)
             {
                 if(t.err[3]>threshold) continue;
                 if(t.deleted) continue;
                 if(t.dirty) continue;
 
-                for(size_t j: {0, 1, 2})
-                {
-                    if(t.err[j] >= threshold)
-                    {
-                        continue;
-                    }
-
-                    int i0=t.v[ j     ]; Vertex &v0 = vertices[i0];
-                    int i1=t.v[(j+1)%3]; Vertex &v1 = vertices[i1];
-                    // Border check
-                    if(v0.border != v1.border)  continue;
-
-                    // Compute vertex to collapse to
-                    vec3f p;
-                    calculate_error(i0,i1,p);
-                    deleted0.resize(v0.tcount); // normals temporarily
-                    deleted1.resize(v1.tcount); // normals temporarily
-                    // don't remove if flipped
-                    if( flipped(p,i0,i1,v0,v1,deleted0) ) continue;
-
-                    if( flipped(p,i1,i0,v1,v0,deleted1) ) continue;
-
-                    if ( (t.attr & TEXCOORD) == TEXCOORD  )
-                    {
-                        update_uvs(i0,v0,p,deleted0);
-                        update_uvs(i0,v1,p,deleted1);
-                    }
-
-                    // not flipped, so remove edge
-                    v0.p=p;
-                    v0.q=v1.q+v0.q;
-                    int tstart=refs.size();
-
-                    update_triangles(i0,v0,deleted0,deleted_triangles);
-                    update_triangles(i0,v1,deleted1,deleted_triangles);
+                collapse_triangle(t, threshold, scratch, deleted_triangles);
 
-                    size_t tcount = refs.size() - tstart;
-
-                    if(tcount<=v0.tcount)
-                    {
-                        // save ram
-                        if(tcount)memcpy(&refs[v0.tstart],&refs[tstart],tcount*sizeof(Ref));
-                    }
-                    else
-                        // append
-                        v0.tstart=tstart;
-
-                    v0.tcount=tcount;
-                    break;
-                }
                 // done?
                 if(triangle_count-deleted_triangles<=target_count)break;
             }
+            store_collapses(scratch);
+            serial_only = false;
+            // no edge within the error bound is left
+            if (bounded && deleted_triangles == deleted_before) break;
         }
+        collapse_error = sqrt(scratch.max_collapse_error);
         // clean up mesh
         compact_mesh();
     } //simplify_mesh()
 
+    //
+    // Lossless simplification
+    //
+    // Collapses the edges with (almost) zero quadric error, which do not
+    // change the shape of the surface. Instead of sweeping over all
+    // triangles until nothing changes, a worklist holds the triangles that
+    // have such an edge, and a collapse only queues the triangles around the
+    // remaining vertex, whose errors were updated. Collapses rejected
+    // because of flips may become possible after the neighborhood changed,
+    // so the whole mesh is swept again once the worklist is empty, until a
+    // sweep collapses nothing (usually after the second sweep).
+    //
+
     void simplify_mesh_lossless(bool verbose=false)
     {
         // init
         for(Triangle& t: triangles) { t.deleted=0; }
+        update_mesh(0, verbose);
 
-        // main iteration loop
+        const double threshold = DBL_EPSILON;
         int deleted_triangles=0;
-        std::vector<int> deleted0,deleted1;
-        //int iteration = 0;
-        //loop(iteration,0,100)
-        for (int iteration = 0; iteration < 9999; iteration ++)
+        int triangle_count=triangles.size();
+        CollapseScratch scratch;
+        size_t collapses=0;
+        aborted=false;
+        collapse_records.clear();
+        // the dirty flag marks the triangles in the worklist
+        std::vector<int> worklist;
+        for (int sweep = 0; !aborted; sweep ++)
         {
-            // update mesh constantly
-            update_mesh(iteration);
-            // clear dirty flag
-            for(Triangle& t: triangles) { t.dirty=0; }
-            //
-            // All triangles with edges below the threshold will be removed
-            //
-            // The following numbers works well for most models.
-            // If it does not, try to adjust the 3 parameters
-            //
-            double threshold = DBL_EPSILON; //1.0E-3 EPS;
+            size_t sweep_collapses=collapses;
+            // in reverse, so that triangles are popped in the order of their ids
+            for(int i = int(triangles.size())-1; i >= 0; --i)
+            {
+                Triangle &t=triangles[i];
+                t.dirty=(!t.deleted && t.err[3]<threshold);
+                if(t.dirty) worklist.push_back(i);
+            }
             if (verbose) {
-                printf("lossless iteration %d\n", iteration);
+                printf("lossless sweep %d - %zu queued triangles\n", sweep, worklist.size());
             }
-
-            // remove vertices & mark deleted triangles
-            for(Triangle& t: triangles)
+            while(!worklist.empty())
             {
-                if(t.err[3]>threshold) continue;
+                Triangle &t=triangles[worklist.back()];
+                worklist.pop_back();
+                t.dirty=0;
                 if(t.deleted) continue;
-                if(t.dirty) continue;
-
-                for(size_t j: {0, 1, 2})
+                if(!collapse_triangle(t, threshold, scratch, deleted_triangles)) continue;
+                collapses++;
+                // the mesh is not updated between sweeps, so the references
+                // appended by the collapses are removed here
+                if(refs.size() > 6*size_t(triangle_count-deleted_triangles)) compact_refs();
+                for(const Ref &r: scratch.refs)
+                {
+                    Triangle &n=triangles[r.tid];
+                    if(n.dirty || n.err[3]>=threshold) continue;
+                    n.dirty=1;
+                    worklist.push_back(r.tid);
+                }
+                if(progress_interval > 0 && collapses%progress_interval==0
+                    && !report_progress(-1, int(collapses), triangle_count-deleted_triangles, threshold))
                 {
-                    if(t.err[j] >= threshold)
-                    {
-                        continue;
-                    }
-                    int i0=t.v[ j     ]; Vertex &v0 = vertices[i0];
-                    int i1=t.v[(j+1)%3]; Vertex &v1 = vertices[i1];
-
-                    // Border check
-                    if(v0.border != v1.border)  continue;
-
-                    // Compute vertex to collapse to
-                    vec3f p;
-                    calculate_error(i0,i1,p);
-
-                    deleted0.resize(v0.tcount); // normals temporarily
-                    deleted1.resize(v1.tcount); // normals temporarily
-
-                    // don't remove if flipped
-                    if( flipped(p,i0,i1,v0,v1,deleted0) ) continue;
-                    if( flipped(p,i1,i0,v1,v0,deleted1) ) continue;
-
-                    if ( (t.attr & TEXCOORD) == TEXCOORD )
-                    {
-                        update_uvs(i0,v0,p,deleted0);
-                        update_uvs(i0,v1,p,deleted1);
-                    }
-
-                    // not flipped, so remove edge
-                    v0.p=p;
-                    v0.q=v1.q+v0.q;
-                    size_t tstart = refs.size();
-
-                    update_triangles(i0,v0,deleted0,deleted_triangles);
-                    update_triangles(i0,v1,deleted1,deleted_triangles);
-
-                    size_t tcount = refs.size() - tstart;
-
-                    if(tcount <= v0.tcount)
-                    {
-                        // save ram
-                        if(tcount)memcpy(&refs[v0.tstart],&refs[tstart],tcount*sizeof(Ref));
-                    }
-                    else
-                        // append
-                        v0.tstart=tstart;
-
-                    v0.tcount=tcount;
                     break;
                 }
             }
-            if(deleted_triangles<=0)break;
-            deleted_triangles=0;
-        } //for each iteration
+            worklist.clear();
+            if(collapses==sweep_collapses) break;
+        }
+        if(verbose)
+        {
+            printf("%zu lossless collapses - triangles %d\n", collapses, triangle_count-deleted_triangles);
+        }
+        for(Triangle& t: triangles) { t.dirty=0; }
+        store_collapses(scratch);
+        collapse_error = sqrt(scratch.max_collapse_error);
         // clean up mesh
         compact_mesh();
     } //simplify_mesh_lossless()
 
+    //
+    // Priority queue simplification
+    //
+    // Edges are collapsed in the order of increasing quadric error (as in
+    // Garland and Heckbert) until exactly target_count triangles remain, so
+    // there are no threshold sweeps over the whole mesh. Triangles are kept
+    // in an indexed min-heap keyed by their smallest edge error; triangles
+    // modified by a collapse are moved to their new position in the heap,
+    // while deleted triangles are left in place and skipped when popped.
+    // A triangle whose edges cannot be collapsed (due to flips) is only
+    // queued again when a neighbor collapse changes it.
+    //
 
-    // Check if a triangle flips when this edge is removed
-
-    bool flipped(vec3f p,int i0,int i1,Vertex &v0,Vertex &v1,std::vector<int> &deleted)
+    void simplify_mesh_heap(int target_count, bool verbose=false)
     {
-        (void)i0; // unused
-        (void)v1; // unused
+        // init
+        for(Triangle& t: triangles) { t.deleted=0; }
+        update_mesh(0, verbose);
 
-        for(size_t k = 0; k < v0.tcount; ++k)
-        {
-            Triangle &t=triangles[refs[v0.tstart+k].tid];
-            if(t.deleted)continue;
+        int deleted_triangles=0;
+        int triangle_count=triangles.size();
+        CollapseScratch scratch;
+        aborted=false;
+        collapse_records.clear();
+        collapse_heap(target_count, triangle_count, deleted_triangles, scratch, verbose);
+        store_collapses(scratch);
+        collapse_error = sqrt(scratch.max_collapse_error);
+        // clean up mesh
+        compact_mesh();
+    } //simplify_mesh_heap()
 
-            int s=refs[v0.tstart+k].tvertex;
-            int id1=t.v[(s+1)%3];
-            int id2=t.v[(s+2)%3];
+    //
+    // Parallel priority queue simplification
+    //
+    // Reduces to exactly target_count triangles as simplify_mesh_heap, but
+    // most collapses are done in parallel. Each round collapses the edges
+    // with an error below a threshold chosen so that about a quarter of the
+    // remaining reduction falls below it. The mesh is split into spatial
+    // cells as in simplify_mesh and each cell collapses its edges below the
+    // threshold in the order of increasing error, using a local queue. The
+    // last part of the reduction (when few collapses are left per round) is
+    // done by the serial priority queue. Quadrics and constraints are kept
+    // across rounds.
+    // The error order is only kept within a cell: edges crossing cell
+    // boundaries wait for a later round while the cells collapse edges up
+    // to the threshold. So the result differs from simplify_mesh_heap (with
+    // similar error and triangle quality on average). With deterministic
+    // enabled the rounds are also run on a single thread, so the result
+    // does not depend on the number of threads; otherwise a single thread
+    // runs simplify_mesh_heap.
+    //
 
-            if(id1==i1 || id2==i1) // delete ?
-            {
+    void simplify_mesh_heap_parallel(int target_count, bool verbose=false)
+    {
+        // init
+        for(Triangle& t: triangles) { t.deleted=0; }
+        update_mesh(0, verbose);
 
-                deleted[k]=1;
-                continue;
+        int deleted_triangles=0;
+        int triangle_count=triangles.size();
+        CollapseScratch scratch;
+        aborted=false;
+        collapse_records.clear();
+        std::vector<double> errors;
+        for(int round = 1; thread_count() > 1 || deterministic; ++round)
+        {
+            int alive=triangle_count-deleted_triangles;
+            int remaining=alive-target_count;
+            if(remaining < alive/50 || alive < parallel_min_triangles) break;
+            if(!report_progress(double(deleted_triangles)/(triangle_count-target_count), round, alive, 0)) break;
+
+            // rebuild the references, so that each round has room in the
+            // ref list for its cells
+            update_mesh(round, verbose);
+
+            // each collapse removes about two triangles, and every edge is
+            // the smallest error edge of up to two triangles
+            errors.clear();
+            for(const Triangle &t: triangles) { errors.push_back(t.err[3]); }
+            size_t k=std::min(errors.size()-1, size_t(remaining/4));
+            std::nth_element(errors.begin(), errors.begin()+k, errors.end());
+            double threshold=errors[k];
+            if(max_error > 0) threshold=std::min(threshold, max_error*max_error);
+            if(verbose)
+            {
+                printf("round %d - triangles %d threshold %g\n", round, alive, threshold);
             }
-            vec3f d1 = vertices[id1].p-p; d1.normalize();
-            vec3f d2 = vertices[id2].p-p; d2.normalize();
-            if(fabs(d1.dot(d2))>0.999) return true;
-            vec3f n;
-            n.cross(d1,d2);
-            n.normalize();
-            deleted[k]=0;
-            if(n.dot(t.n)<0.2) return true;
-        }
-        return false;
-    }
-
-    // update_uvs
 
-    void update_uvs(int i0,const Vertex &v,const vec3f &p,std::vector<int> &deleted)
-    {
-        (void)i0; // unused
-        for(size_t k = 0; k < v.tcount; ++k)
+            int deleted=collapse_parallel(round, threshold, remaining, scratch.max_collapse_error, true);
+            deleted_triangles+=deleted;
+            if(deleted < remaining/200) break;
+        }
+        if(!aborted)
         {
-            Ref &r=refs[v.tstart+k];
-            Triangle &t=triangles[r.tid];
-            if(t.deleted)continue;
-            if(deleted[k])continue;
-            vec3f p1=vertices[t.v[0]].p;
-            vec3f p2=vertices[t.v[1]].p;
-            vec3f p3=vertices[t.v[2]].p;
-            t.uvs[r.tvertex] = interpolate(p,p1,p2,p3,t.uvs);
+            // finish serially, continuing with the current quadrics
+            update_mesh(1, verbose);
+            collapse_heap(target_count, triangle_count, deleted_triangles, scratch, verbose);
         }
-    }
+        store_collapses(scratch);
+        collapse_error = sqrt(scratch.max_collapse_error);
+        // clean up mesh
+        compact_mesh();
+    } //simplify_mesh_heap_parallel()
 
-    // Update triangle connections and edge error after a edge is collapsed
+    //
+    // Vertex clustering
+    //
+    // Vertices are grouped by the cells of a uniform grid, and the vertices
+    // of each cell are replaced by a single vertex at the minimum of the sum
+    // of their quadrics (as in Lindstrom's out-of-core simplification), or at
+    // their mean position if that minimum is not well defined or falls
+    // outside of the cell. Triangles that lose a vertex or become duplicates
+    // are removed. Each step is a linear parallel pass (except sorting the
+    // remaining triangles to find duplicates), so this is much faster than
+    // edge collapses, but less accurate and the topology is not preserved.
+    // The cell size is estimated from the surface area so that about
+    // target_count triangles remain. Constraint planes of border and
+    // feature edges are added as in simplify_mesh, with lock_border the
+    // border vertices are not clustered. The result does not depend on the
+    // number of threads.
+    //
 
-    void update_triangles(int i0,Vertex &v,std::vector<int> &deleted,int &deleted_triangles)
+    void simplify_mesh_clustering(int target_count, bool verbose=false)
     {
-        vec3f p;
-        for(size_t k = 0; k < v.tcount; ++k)
+        for(Triangle& t: triangles) { t.deleted=0; }
+        collapse_error = 0;
+        aborted = false;
+        collapse_records.clear();
+        size_t vertex_n = vertices.size(), triangle_n = triangles.size();
+        if(target_count <= 0 || triangle_n <= (size_t)target_count)
         {
-            Ref &r=refs[v.tstart+k];
-            Triangle &t=triangles[r.tid];
-            if(t.deleted)continue;
-            if(deleted[k])
+            compact_mesh();
+            return;
+        }
+        int thread_n = thread_count();
+
+        // Triangle planes and surface area, summed by chunks so that the
+        // sum does not depend on the number of threads
+        normals.resize(triangle_n);
+        std::vector<double> plane_d(triangle_n);
+        size_t chunk_n = (triangle_n+parallel_chunk-1)/parallel_chunk;
+        std::vector<double> chunk_area(chunk_n, 0.0);
+        parallel_for(triangle_n, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
             {
-                t.deleted=1;
-                deleted_triangles++;
-                continue;
+                Triangle &t = triangles[i];
+                vec3f n;
+                n.cross(vertices[t.v[1]].p-vertices[t.v[0]].p, vertices[t.v[2]].p-vertices[t.v[0]].p);
+                chunk_area[i/parallel_chunk] += n.length()/2;
+                n.normalize();
+                normals[i]=n;
+                plane_d[i]=-n.dot(vertices[t.v[0]].p);
             }
-            t.v[r.tvertex]=i0;
-            t.dirty=1;
-            t.err[0]=calculate_error(t.v[0],t.v[1],p);
-            t.err[1]=calculate_error(t.v[1],t.v[2],p);
-            t.err[2]=calculate_error(t.v[2],t.v[0],p);
-            t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
-            refs.push_back(r);
-        }
-    }
-
-    // compact triangles, compute edge error and build reference list
-
-    void update_mesh(int iteration)
-    {
-        if(iteration>0) // compact triangles
+        });
+        double area = 0;
+        for(double a: chunk_area) { area += a; }
+
+        // Vertex quadrics (as in update_mesh) and bounding box
+        update_refs();
+        vec3f bmin(DBL_MAX, DBL_MAX, DBL_MAX), bmax(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+        std::mutex bounds_mutex;
+        parallel_for(vertex_n, [&](size_t begin, size_t end)
         {
-            int dst=0;
-            for (Triangle &t: triangles)
+            vec3f lo(DBL_MAX, DBL_MAX, DBL_MAX), hi(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+            for(size_t i = begin; i < end; ++i)
             {
-                if(t.deleted)
+                Vertex &v = vertices[i];
+                v.q = SymetricMatrix(0.0);
+                v.border = 0;
+                for(size_t k = 0; k < v.tcount; ++k)
                 {
-                    continue;
+                    int tid = refs[v.tstart+k].tid;
+                    const vec3f &n = normals[tid];
+                    v.q += SymetricMatrix(n.x,n.y,n.z,plane_d[tid]);
                 }
-                triangles[dst] = t;
-                dst++;
+                if(v.tcount == 0) continue;
+                lo.x=fmin(lo.x,v.p.x); lo.y=fmin(lo.y,v.p.y); lo.z=fmin(lo.z,v.p.z);
+                hi.x=fmax(hi.x,v.p.x); hi.y=fmax(hi.y,v.p.y); hi.z=fmax(hi.z,v.p.z);
             }
-            triangles.resize(dst);
+            std::lock_guard<std::mutex> lock(bounds_mutex);
+            bmin.x=fmin(bmin.x,lo.x); bmin.y=fmin(bmin.y,lo.y); bmin.z=fmin(bmin.z,lo.z);
+            bmax.x=fmax(bmax.x,hi.x); bmax.y=fmax(bmax.y,hi.y); bmax.z=fmax(bmax.z,hi.z);
+        });
+        if(border_weight > 0 || (feature_angle > 0 && feature_weight > 0))
+        {
+            add_constraint_planes();
         }
-        //
-        // Init Quadrics by Plane & Edge Errors
-        //
-        // required at the beginning ( iteration == 0 )
-        // recomputing during the simplification is not required,
-        // but mostly improves the result for closed meshes
-        //
-        if( iteration == 0 )
+        if(lock_border)
         {
-            for(Vertex& v: vertices)
+            identify_border();
+        }
+        if(!report_progress(0.5, 0, int(triangle_n), 0))
+        {
+            compact_mesh();
+            return;
+        }
+
+        // A surface crosses about 1.5 cells per cell face area, and a closed
+        // mesh has about two triangles per vertex. Cell coordinates are
+        // limited to 21 bits, so that the cell fits into a 63 bit key.
+        vec3f extent = bmax-bmin;
+        double cell = sqrt(3*area/target_count);
+        cell = std::max(cell, std::max(extent.x, std::max(extent.y, extent.z))/double((1 << 21)-2));
+        if(!(cell > 0)) cell = 1;
+
+        // Cluster of each vertex: the first vertex of each cell is found
+        // through a hash table of the cells, then clusters are numbered in
+        // the order of their first vertices
+        const uint64_t empty = ~uint64_t(0);
+        size_t table_n = 1;
+        while(table_n < 2*vertex_n) table_n <<= 1;
+        std::vector<std::atomic<uint64_t>> table_key(table_n);
+        std::vector<std::atomic<int>> table_first(table_n);
+        parallel_for(table_n, [&](size_t begin, size_t end)
+        {
+            for(size_t s = begin; s < end; ++s)
             {
-                v.q = SymetricMatrix(0.0);
+                table_key[s].store(empty, std::memory_order_relaxed);
+                table_first[s].store(INT_MAX, std::memory_order_relaxed);
+            }
+        });
+        std::vector<int> vertex_cluster(vertex_n);
+        parallel_for(vertex_n, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                const Vertex &v = vertices[i];
+                if(v.tcount == 0) continue;
+                uint64_t key;
+                if(v.border)
+                {
+                    key = (uint64_t(1) << 63) | i;
+                }
+                else
+                {
+                    key = uint64_t((v.p.x-bmin.x)/cell) | (uint64_t((v.p.y-bmin.y)/cell) << 21) | (uint64_t((v.p.z-bmin.z)/cell) << 42);
+                }
+                uint64_t hash = key*0x9E3779B97F4A7C15ull;
+                size_t s = size_t(hash ^ (hash >> 29)) & (table_n-1);
+                for(;; s = (s+1) & (table_n-1))
+                {
+                    uint64_t found = table_key[s].load(std::memory_order_relaxed);
+                    if(found == empty && table_key[s].compare_exchange_strong(found, key, std::memory_order_relaxed)) break;
+                    if(found == key) break;
+                }
+                vertex_cluster[i] = int(s);
+                int first = table_first[s].load(std::memory_order_relaxed);
+                while(int(i) < first && !table_first[s].compare_exchange_weak(first, int(i), std::memory_order_relaxed)) {}
+            }
+        });
+        size_t block = (vertex_n+thread_n-1)/thread_n;
+        std::vector<int> block_start(thread_n+1, 0);
+        auto is_first = [&](size_t i)
+        {
+            return vertices[i].tcount > 0 && table_first[vertex_cluster[i]].load(std::memory_order_relaxed) == int(i);
+        };
+        run_threads([&](int b)
+        {
+            size_t end = std::min(vertex_n, (b+1)*block);
+            for(size_t i = b*block; i < end; ++i) { block_start[b+1] += is_first(i); }
+        });
+        for(int b = 0; b < thread_n; ++b) { block_start[b+1] += block_start[b]; }
+        int cluster_n = block_start[thread_n];
+        std::vector<int> cluster_first(cluster_n);
+        run_threads([&](int b)
+        {
+            size_t end = std::min(vertex_n, (b+1)*block);
+            int id = block_start[b];
+            for(size_t i = b*block; i < end; ++i)
+            {
+                if(is_first(i)) cluster_first[id++] = int(i);
+            }
+        });
+        // the first vertex of a cluster stores the cluster id in its slot
+        parallel_for(cluster_n, [&](size_t begin, size_t end)
+        {
+            for(size_t c = begin; c < end; ++c) { table_first[vertex_cluster[cluster_first[c]]].store(int(c), std::memory_order_relaxed); }
+        });
+        parallel_for(vertex_n, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                if(vertices[i].tcount) vertex_cluster[i] = table_first[vertex_cluster[i]].load(std::memory_order_relaxed);
+            }
+        });
+        std::vector<std::atomic<uint64_t>>().swap(table_key);
+        std::vector<std::atomic<int>>().swap(table_first);
+
+        // Vertices of each cluster, in the order of their ids
+        std::vector<std::atomic<int>> cursor(cluster_n);
+        parallel_for(cluster_n, [&](size_t begin, size_t end)
+        {
+            for(size_t c = begin; c < end; ++c) { cursor[c].store(0, std::memory_order_relaxed); }
+        });
+        parallel_for(vertex_n, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                if(vertices[i].tcount) cursor[vertex_cluster[i]].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        std::vector<int> member_start(cluster_n+1, 0);
+        for(int c = 0; c < cluster_n; ++c)
+        {
+            member_start[c+1] = member_start[c]+cursor[c].load(std::memory_order_relaxed);
+            cursor[c].store(member_start[c], std::memory_order_relaxed);
+        }
+        std::vector<int> members(member_start[cluster_n]);
+        parallel_for(vertex_n, [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                if(vertices[i].tcount) members[cursor[vertex_cluster[i]].fetch_add(1, std::memory_order_relaxed)] = int(i);
+            }
+        });
+        std::vector<std::atomic<int>>().swap(cursor);
+
+        // Position (and attributes) of the cluster vertices
+        std::vector<vec3f> cluster_p(cluster_n);
+        std::vector<float> cluster_attributes(vertex_attribute_components*(size_t)cluster_n);
+        std::vector<double> chunk_error((cluster_n+parallel_chunk-1)/parallel_chunk, 0.0);
+        parallel_for(cluster_n, [&](size_t begin, size_t end)
+        {
+            for(size_t c = begin; c < end; ++c)
+            {
+                int *m = &members[member_start[c]];
+                int count = member_start[c+1]-member_start[c];
+                std::sort(m, m+count);
+                SymetricMatrix q(0.0);
+                vec3f mean(0, 0, 0);
+                for(int k = 0; k < count; ++k)
+                {
+                    q += vertices[m[k]].q;
+                    mean = mean+vertices[m[k]].p;
+                }
+                mean = mean/double(count);
+                vec3f p = count == 1 ? vertices[m[0]].p : mean;
+                double det = quadric_det(q.m);
+                if(count > 1 && det != 0)
+                {
+                    // accepted within half a cell from the cell of the cluster
+                    vec3f center = vertices[m[0]].p;
+                    center.x = bmin.x+(floor((center.x-bmin.x)/cell)+0.5)*cell;
+                    center.y = bmin.y+(floor((center.y-bmin.y)/cell)+0.5)*cell;
+                    center.z = bmin.z+(floor((center.z-bmin.z)/cell)+0.5)*cell;
+                    vec3f x;
+                    quadric_solve(q.m, det, x.x, x.y, x.z);
+                    if(fabs(x.x-center.x) <= cell && fabs(x.y-center.y) <= cell && fabs(x.z-center.z) <= cell) p = x;
+                }
+                cluster_p[c] = p;
+                double &error = chunk_error[c/parallel_chunk];
+                error = std::max(error, vertex_error(q, p.x, p.y, p.z));
+                for(size_t a = 0; a < (size_t)vertex_attribute_components; ++a)
+                {
+                    const float *values = &vertex_attributes[a*vertex_n];
+                    if(!vertex_attribute_discrete.empty() && vertex_attribute_discrete[a])
+                    {
+                        cluster_attributes[a*cluster_n+c] = values[cluster_first[c]];
+                        continue;
+                    }
+                    double sum = 0;
+                    for(int k = 0; k < count; ++k) { sum += values[m[k]]; }
+                    cluster_attributes[a*cluster_n+c] = float(sum/count);
+                }
+            }
+        });
+        double max_cluster_error = 0;
+        for(double e: chunk_error) { max_cluster_error = std::max(max_cluster_error, e); }
+        collapse_error = sqrt(max_cluster_error);
+
+        // Triangles of the clusters without the degenerate ones
+        std::atomic<size_t> degenerate(0);
+        parallel_for(triangle_n, [&](size_t begin, size_t end)
+        {
+            size_t removed = 0;
+            for(size_t i = begin; i < end; ++i)
+            {
+                Triangle &t = triangles[i];
+                for(int j: {0, 1, 2}) { t.v[j] = vertex_cluster[t.v[j]]; }
+                t.deleted = (t.v[0] == t.v[1] || t.v[1] == t.v[2] || t.v[2] == t.v[0]);
+                removed += t.deleted;
+            }
+            degenerate += removed;
+        });
+        // ... and without duplicates (the first one of the same orientation is kept)
+        struct Face { int v[3]; int id; };
+        std::vector<Face> faces;
+        faces.reserve(triangle_n-degenerate);
+        for(size_t i = 0; i < triangle_n; ++i)
+        {
+            const Triangle &t = triangles[i];
+            if(t.deleted) continue;
+            int j = (t.v[0] < t.v[1] && t.v[0] < t.v[2]) ? 0 : (t.v[1] < t.v[2] ? 1 : 2);
+            Face f = { { t.v[j], t.v[(j+1)%3], t.v[(j+2)%3] }, int(i) };
+            faces.push_back(f);
+        }
+        std::sort(faces.begin(), faces.end(), [](const Face &a, const Face &b)
+        {
+            return a.v[0] != b.v[0] ? a.v[0] < b.v[0] : a.v[1] != b.v[1] ? a.v[1] < b.v[1] : a.v[2] != b.v[2] ? a.v[2] < b.v[2] : a.id < b.id;
+        });
+        for(size_t i = 1; i < faces.size(); ++i)
+        {
+            const Face &a = faces[i-1], &b = faces[i];
+            if(a.v[0] == b.v[0] && a.v[1] == b.v[1] && a.v[2] == b.v[2]) triangles[b.id].deleted = 1;
+        }
+
+        vertices.resize(cluster_n);
+        for(int c = 0; c < cluster_n; ++c) { vertices[c].p = cluster_p[c]; }
+        vertex_attributes.swap(cluster_attributes);
+        compact_mesh();
+        if(track_vertex_origin)
+        {
+            for(int &origin: vertex_origin) { origin = cluster_first[origin]; }
+        }
+        if(verbose)
+        {
+            printf("clustering: cell size %g, %d clusters, %zu -> %zu triangles, error %g\n",
+                cell, cluster_n, triangle_n, triangles.size(), collapse_error);
+        }
+    } //simplify_mesh_clustering()
+
+    int thread_count() const
+    {
+        if (thread_pool) return thread_pool->size();
+        if (threads > 0) return threads;
+        int n = (int)std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+protected:
+
+    // Call progress_callback if set, returns false if the simplification is aborted
+
+    bool report_progress(double fraction, int iteration, int triangle_count, double threshold)
+    {
+        if(!progress_callback) return true;
+        Progress progress = { std::min(fraction, 1.0), iteration, triangle_count, threshold };
+        if(!progress_callback(progress)) aborted = true;
+        return !aborted;
+    }
+
+    // Meshes smaller than this are always simplified on a single thread
+    static const int parallel_min_triangles = 20000;
+
+    // Indexed binary min-heap of triangle ids keyed by edge error. The
+    // position of each triangle is tracked, so its key can be changed
+    // (or the triangle requeued) in O(log n).
+    class TriangleHeap
+    {
+    public:
+        void build(const std::vector<Triangle> &triangles)
+        {
+            nodes.clear();
+            pos.assign(triangles.size(), -1);
+            for(size_t i = 0; i < triangles.size(); ++i)
+            {
+                if(triangles[i].deleted) continue;
+                pos[i] = nodes.size();
+                nodes.push_back(Node{triangles[i].err[3], int(i)});
+            }
+            for(size_t i = nodes.size()/2; i-- > 0;) { sift_down(i); }
+        }
+        bool empty() const { return nodes.empty(); }
+        double top_key() const { return nodes[0].key; }
+        int pop()
+        {
+            int tid = nodes[0].tid;
+            pos[tid] = -1;
+            Node last = nodes.back();
+            nodes.pop_back();
+            if(!nodes.empty())
+            {
+                nodes[0] = last;
+                pos[last.tid] = 0;
+                sift_down(0);
+            }
+            return tid;
+        }
+        // Change the key of a triangle or insert it if it is not queued
+        void update(int tid, double key)
+        {
+            int i = pos[tid];
+            if(i < 0)
+            {
+                i = nodes.size();
+                nodes.push_back(Node{key, tid});
+                pos[tid] = i;
+                sift_up(i);
+                return;
+            }
+            double old = nodes[i].key;
+            nodes[i].key = key;
+            if(key < old) sift_up(i);
+            else sift_down(i);
+        }
+    private:
+        struct Node
+        {
+            double key;
+            int tid;
+            bool operator<(const Node &o) const { return key < o.key || (key == o.key && tid < o.tid); }
+        };
+        void place(size_t i, const Node &n) { nodes[i] = n; pos[n.tid] = i; }
+        void sift_up(size_t i)
+        {
+            Node n = nodes[i];
+            while(i > 0)
+            {
+                size_t parent = (i-1)/2;
+                if(!(n < nodes[parent])) break;
+                place(i, nodes[parent]);
+                i = parent;
+            }
+            place(i, n);
+        }
+        void sift_down(size_t i)
+        {
+            Node n = nodes[i];
+            size_t count = nodes.size();
+            for(;;)
+            {
+                size_t child = 2*i+1;
+                if(child >= count) break;
+                if(child+1 < count && nodes[child+1] < nodes[child]) child++;
+                if(!(nodes[child] < n)) break;
+                place(i, nodes[child]);
+                i = child;
+            }
+            place(i, n);
+        }
+        std::vector<Node> nodes;
+        std::vector<int> pos;
+    };
+
+    // Working buffers of one collapse worker
+    struct CollapseScratch
+    {
+        std::vector<int> deleted0,deleted1;
+        std::vector<Ref> refs;
+        // Parallel pass only: cell labels of vertices, the cell owned by
+        // this worker and the free range in refs reserved for this cell
+        const int *vertex_cell = nullptr;
+        int cell = 0;
+        size_t refs_begin = 0, refs_end = 0;
+        // Largest quadric error of the collapses of this worker
+        double max_collapse_error = 0;
+        // Collapses not yet added to collapse_records (if recorded)
+        std::vector<CollapseRecord> collapses;
+        std::vector<int> orphans;
+    };
+
+    // Append the collapses of a scratch to collapse_records
+
+    void store_collapses(CollapseScratch &s)
+    {
+        collapse_records.insert(collapse_records.end(), s.collapses.begin(), s.collapses.end());
+        s.collapses.clear();
+    }
+
+    // Collapse edges in the order of increasing error until target_count
+    // triangles remain (the mesh must be updated, the references may not
+    // refer to deleted triangles)
+
+    void collapse_heap(int target_count, int triangle_count, int &deleted_triangles, CollapseScratch &scratch, bool verbose)
+    {
+        TriangleHeap heap;
+        heap.build(triangles);
+
+        size_t collapses=0, last_rebuild=0;
+        while(triangle_count-deleted_triangles>target_count)
+        {
+            if(heap.empty())
+            {
+                // all queued triangles were tried, retry the ones that were
+                // rejected since neighbor collapses may have resolved their flips
+                if(collapses==last_rebuild) break;
+                last_rebuild=collapses;
+                heap.build(triangles);
+                continue;
+            }
+            double err=heap.top_key();
+            // all remaining edges exceed the error bound
+            if(max_error > 0 && err > max_error*max_error) break;
+            Triangle &t=triangles[heap.pop()];
+            if(t.deleted) continue;
+
+            // try the edges in the order of increasing error
+            int order[3] = {0, 1, 2};
+            std::sort(order, order+3, [&t](int a, int b) { return t.err[a] < t.err[b]; });
+            bool collapsed=false;
+            for(int j: order)
+            {
+                if(collapse_edge(t,j,scratch,deleted_triangles))
+                {
+                    collapsed=true;
+                    break;
+                }
+            }
+            if(!collapsed) continue;
+            collapses++;
+            if(refs.size() > 6*size_t(triangle_count-deleted_triangles)) compact_refs();
+
+            // requeue the triangles around the remaining vertex with updated errors
+            for(const Ref &r: scratch.refs)
+            {
+                heap.update(r.tid, triangles[r.tid].err[3]);
+            }
+
+            if(verbose && collapses%100000==0)
+            {
+                printf("collapse %zu - triangles %d error %g\n", collapses, triangle_count-deleted_triangles, err);
+            }
+            if(progress_interval > 0 && collapses%progress_interval==0 && !report_progress(double(deleted_triangles)/(triangle_count-target_count),
+                int(collapses), triangle_count-deleted_triangles, err))
+            {
+                break;
+            }
+        }
+        if(verbose)
+        {
+            printf("%zu collapses - triangles %d\n", collapses, triangle_count-deleted_triangles);
+        }
+    }
+
+    // Collapse the first edge of t that has an error below the threshold
+    // and does not flip any of the neighbor triangles
+
+    bool collapse_triangle(Triangle &t, double threshold, CollapseScratch &s, int &deleted_triangles)
+    {
+        for(size_t j: {0, 1, 2})
+        {
+            if(t.err[j] >= threshold)
+            {
+                continue;
+            }
+            if(collapse_edge(t, j, s, deleted_triangles))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Collapse edge j of t (vertex j to vertex j+1) unless it would flip a
+    // neighbor triangle. On success s.refs holds the updated triangles
+    // around the remaining vertex.
+
+    bool collapse_edge(Triangle &t, int j, CollapseScratch &s, int &deleted_triangles)
+    {
+        int i0=t.v[ j     ]; Vertex &v0 = vertices[i0];
+        int i1=t.v[(j+1)%3]; Vertex &v1 = vertices[i1];
+        // Border check
+        if(v0.border != v1.border)  return false;
+        if(lock_border && v0.border)  return false;
+
+        if (s.vertex_cell)
+        {
+            // All triangles modified by the collapse must belong to the cell of this worker
+            if (!in_cell(v0, s) || !in_cell(v1, s)) return false;
+            if (s.refs_end - s.refs_begin < v0.tcount + v1.tcount) return false;
+        }
+
+        // Compute vertex to collapse to
+        vec3f p;
+        double error = calculate_error(i0,i1,p);
+        if(max_error > 0 && error > max_error*max_error) return false;
+        s.deleted0.resize(v0.tcount); // normals temporarily
+        s.deleted1.resize(v1.tcount); // normals temporarily
+        // don't remove if flipped
+        if( flipped(p,i0,i1,v0,v1,s.deleted0) ) return false;
+
+        if( flipped(p,i1,i0,v1,v0,s.deleted1) ) return false;
+
+        if ( (t.attr & TEXCOORD) == TEXCOORD  )
+        {
+            update_uvs(i0,v0,p,s.deleted0);
+            update_uvs(i0,v1,p,s.deleted1);
+        }
+        if (vertex_attribute_components) update_vertex_attributes(i0,i1,p);
+
+        // not flipped, so remove edge
+        if (record_collapses)
+        {
+            CollapseRecord record = { i1, i0, v1.p, v0.p, p };
+            s.collapses.push_back(record);
+            // third vertices of the removed triangles
+            s.orphans.clear();
+            for(size_t k = 0; k < v0.tcount; ++k)
+            {
+                const Triangle &r=triangles[refs[v0.tstart+k].tid];
+                if(r.deleted || !s.deleted0[k]) continue;
+                for(int c: {0, 1, 2}) { if(r.v[c] != i0 && r.v[c] != i1) s.orphans.push_back(r.v[c]); }
+            }
+        }
+        v0.p=p;
+        v0.q=v1.q+v0.q;
+
+        s.refs.clear();
+        update_triangles(i0,v0,s.deleted0,deleted_triangles,s.refs);
+        update_triangles(i0,v1,s.deleted1,deleted_triangles,s.refs);
+        if (record_collapses) record_orphans(i0,s);
+
+        size_t tcount = s.refs.size();
+
+        if(tcount<=v0.tcount)
+        {
+            // save ram
+            if(tcount)memcpy(&refs[v0.tstart],s.refs.data(),tcount*sizeof(Ref));
+        }
+        else if (s.vertex_cell)
+        {
+            // append to the range reserved for this cell
+            memcpy(&refs[s.refs_begin],s.refs.data(),tcount*sizeof(Ref));
+            v0.tstart=s.refs_begin;
+            s.refs_begin+=tcount;
+        }
+        else
+        {
+            // append
+            v0.tstart=refs.size();
+            refs.insert(refs.end(),s.refs.begin(),s.refs.end());
+        }
+
+        v0.tcount=tcount;
+        if(error > s.max_collapse_error) s.max_collapse_error = error;
+        return true;
+    }
+
+    // A vertex whose last triangles were removed by a collapse into i0 is
+    // recorded as merged into i0 without moving it, so that every removed
+    // vertex has a collapse record
+
+    void record_orphans(int i0, CollapseScratch &s)
+    {
+        const Vertex &v0=vertices[i0];
+        for(int i: s.orphans)
+        {
+            Vertex &v=vertices[i];
+            bool used=false;
+            for(size_t k = 0; k < v.tcount && !used; ++k) { used=!triangles[refs[v.tstart+k].tid].deleted; }
+            if(used || !v.tcount) continue;
+            v.tcount=0; // recorded once
+            CollapseRecord record = { i, i0, v.p, v0.p, v0.p };
+            s.collapses.push_back(record);
+        }
+    }
+
+    // Check if all triangles around a vertex belong to the cell of the worker
+
+    bool in_cell(const Vertex &v, const CollapseScratch &s) const
+    {
+        for(size_t k = 0; k < v.tcount; ++k)
+        {
+            const Triangle &t=triangles[refs[v.tstart+k].tid];
+            if(t.deleted)continue;
+            for(size_t j: {0, 1, 2})
+            {
+                if(s.vertex_cell[t.v[j]] != s.cell) return false;
+            }
+        }
+        return true;
+    }
+
+    //
+    // Parallel collapse pass
+    //
+    // The bounding box is split into a grid of cells and each vertex is
+    // labeled by the cell that contains it. An edge is only collapsed if all
+    // triangles around it are fully inside one cell, therefore workers of
+    // different cells never modify the same vertices, triangles or refs and
+    // all cells can be processed concurrently. The grid is shifted in each
+    // iteration so that edges on cell boundaries get collapsed later.
+    // The grid only depends on the mesh, not on the number of threads.
+    //
+    // Returns the number of deleted triangles, max_collapse_error is updated
+    // with the largest error of the collapses. If ordered is set, each cell
+    // collapses its edges in the order of increasing error (including edges
+    // whose error drops below the threshold after a neighbor collapse),
+    // otherwise in the order of the triangles.
+    //
+
+    int collapse_parallel(int iteration, double threshold, int max_deleted, double &max_collapse_error, bool ordered=false)
+    {
+        // Bounding box of the used vertices
+        vec3f bmin(DBL_MAX,DBL_MAX,DBL_MAX), bmax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+        for(Vertex& v: vertices)
+        {
+            if(v.tcount == 0) continue;
+            bmin.x=fmin(bmin.x,v.p.x); bmin.y=fmin(bmin.y,v.p.y); bmin.z=fmin(bmin.z,v.p.z);
+            bmax.x=fmax(bmax.x,v.p.x); bmax.y=fmax(bmax.y,v.p.y); bmax.z=fmax(bmax.z,v.p.z);
+        }
+        int alive = 0;
+        for(Triangle& t: triangles) { if(!t.deleted) alive++; }
+        int grid = (int)ceil(cbrt(alive / 8192.0));
+        if (grid < 2) grid = 2;
+        vec3f size = (bmax-bmin)/double(grid);
+        if(size.x<=0) size.x=1;
+        if(size.y<=0) size.y=1;
+        if(size.z<=0) size.z=1;
+        double shift = (iteration*0.6180339887) - floor(iteration*0.6180339887);
+        int dim = grid+1;
+        int cell_count = dim*dim*dim;
+
+        std::vector<int> vertex_cell(vertices.size());
+        for(size_t i = 0; i < vertices.size(); ++i)
+        {
+            vec3f c = (vertices[i].p-bmin)/size;
+            int cx = std::min(std::max(int(c.x+shift),0),grid);
+            int cy = std::min(std::max(int(c.y+shift),0),grid);
+            int cz = std::min(std::max(int(c.z+shift),0),grid);
+            vertex_cell[i] = (cz*dim+cy)*dim+cx;
+        }
+
+        // Sort triangles that are fully inside a cell by cell
+        std::vector<int> cell_start(cell_count+1,0);
+        std::vector<int> triangle_cell(triangles.size(),-1);
+        for(size_t i = 0; i < triangles.size(); ++i)
+        {
+            Triangle &t = triangles[i];
+            if(t.deleted || t.err[3]>threshold) continue;
+            int c = vertex_cell[t.v[0]];
+            if(vertex_cell[t.v[1]] != c || vertex_cell[t.v[2]] != c) continue;
+            triangle_cell[i] = c;
+            cell_start[c+1]++;
+        }
+        for(int c = 0; c < cell_count; ++c) { cell_start[c+1] += cell_start[c]; }
+        std::vector<int> cell_triangles(cell_start[cell_count]);
+        {
+            std::vector<int> fill(cell_start.begin(),cell_start.end()-1);
+            for(size_t i = 0; i < triangles.size(); ++i)
+            {
+                if(triangle_cell[i] >= 0) cell_triangles[fill[triangle_cell[i]]++] = i;
+            }
+        }
+        int candidates = cell_start[cell_count];
+        if (candidates == 0) return 0;
+
+        // Reserve a free range of the ref list for each cell
+        size_t refs_base = refs.size();
+        refs.resize(refs_base + 3*size_t(candidates));
+
+        // Each cell may delete its share of the remaining triangles (deterministic)
+        // or all cells stop when the total reaches the limit
+        std::atomic<int> total_deleted(0);
+        std::atomic<int> next_cell(0);
+        std::vector<double> worker_error(thread_count(), 0.0);
+        std::vector<std::vector<CollapseRecord>> cell_collapses(record_collapses ? cell_count : 0);
+        typedef std::pair<double, int> QueueEntry;
+        auto worker = [&](int w)
+        {
+            CollapseScratch s;
+            std::vector<QueueEntry> queue;
+            s.vertex_cell = vertex_cell.data();
+            for(int c = next_cell++; c < cell_count; c = next_cell++)
+            {
+                int count = cell_start[c+1]-cell_start[c];
+                if(count == 0) continue;
+                int quota = int((long long)max_deleted * count / candidates);
+                if(deterministic && quota <= 0) continue;
+                s.cell = c;
+                s.refs_begin = refs_base + 3*size_t(cell_start[c]);
+                s.refs_end = s.refs_begin + 3*size_t(count);
+                int deleted = 0;
+                if(ordered)
+                {
+                    // min-queue of (error, triangle), entries whose error
+                    // changed since they were queued are skipped
+                    queue.clear();
+                    for(int k = cell_start[c]; k < cell_start[c+1]; ++k)
+                    {
+                        queue.push_back(QueueEntry(triangles[cell_triangles[k]].err[3], cell_triangles[k]));
+                    }
+                    std::make_heap(queue.begin(), queue.end(), std::greater<QueueEntry>());
+                }
+                for(int k = cell_start[c]; ordered ? !queue.empty() : k < cell_start[c+1]; ++k)
+                {
+                    int tid = cell_triangles[k];
+                    if(ordered)
+                    {
+                        std::pop_heap(queue.begin(), queue.end(), std::greater<QueueEntry>());
+                        tid = queue.back().second;
+                        double key = queue.back().first;
+                        queue.pop_back();
+                        if(key != triangles[tid].err[3]) continue;
+                    }
+                    Triangle &t = triangles[tid];
+                    if(t.err[3]>threshold) continue;
+                    if(t.deleted) continue;
+                    if(t.dirty && !ordered) continue;
+                    int before = deleted;
+                    if(!collapse_triangle(t, threshold, s, deleted)) continue;
+                    if(ordered)
+                    {
+                        // triangles around the remaining vertex, all in this cell
+                        for(const Ref &r: s.refs)
+                        {
+                            double key = triangles[r.tid].err[3];
+                            if(key > threshold) continue;
+                            queue.push_back(QueueEntry(key, r.tid));
+                            std::push_heap(queue.begin(), queue.end(), std::greater<QueueEntry>());
+                        }
+                    }
+                    if(deterministic)
+                    {
+                        if(deleted >= quota) break;
+                    }
+                    else if((total_deleted += deleted-before) >= max_deleted)
+                    {
+                        break;
+                    }
+                }
+                if(deterministic) total_deleted += deleted;
+                if(record_collapses) cell_collapses[c].swap(s.collapses);
+            }
+            worker_error[w] = s.max_collapse_error;
+        };
+        run_threads(worker);
+        for(double e: worker_error) { max_collapse_error = std::max(max_collapse_error, e); }
+        for(std::vector<CollapseRecord> &collapses: cell_collapses)
+        {
+            collapse_records.insert(collapse_records.end(), collapses.begin(), collapses.end());
+        }
+        return total_deleted;
+    }
+
+    // Run fn(thread_index) on all threads and wait for completion
+
+    void run_threads(const std::function<void(int)> &fn)
+    {
+        int thread_n = thread_count();
+        if(thread_n <= 1)
+        {
+            fn(0);
+            return;
+        }
+        if(!thread_pool) { thread_pool = std::make_shared<FastQuadricThreadPool>(thread_n); }
+        thread_pool->run(thread_n, fn);
+    }
+
+    // Split [0,n) into contiguous ranges and run fn(begin,end) on them in
+    // parallel. Ranges start at multiples of parallel_chunk (a single range
+    // covers everything if there is only one thread).
+
+    static const size_t parallel_chunk = 4096;
+
+    template<typename Function>
+    void parallel_for(size_t n, Function fn)
+    {
+        size_t chunk = parallel_chunk;
+        int thread_n = thread_count();
+        if(thread_n <= 1 || n <= chunk)
+        {
+            fn(size_t(0), n);
+            return;
+        }
+        std::atomic<size_t> next(0);
+        run_threads([&](int)
+        {
+            for(size_t begin = next.fetch_add(chunk); begin < n; begin = next.fetch_add(chunk))
+            {
+                fn(begin, std::min(begin+chunk, n));
+            }
+        });
+    }
+
+    // Check if a triangle flips when this edge is removed
+
+    bool flipped(vec3f p,int i0,int i1,Vertex &v0,Vertex &v1,std::vector<int> &deleted)
+    {
+        (void)i0; // unused
+        (void)v1; // unused
+
+        for(size_t k = 0; k < v0.tcount; ++k)
+        {
+            int tid=refs[v0.tstart+k].tid;
+            Triangle &t=triangles[tid];
+            if(t.deleted)continue;
+
+            int s=refs[v0.tstart+k].tvertex;
+            int id1=t.v[(s+1)%3];
+            int id2=t.v[(s+2)%3];
+
+            if(id1==i1 || id2==i1) // delete ?
+            {
+
+                deleted[k]=1;
+                continue;
+            }
+            vec3f d1 = vertices[id1].p-p; d1.normalize();
+            vec3f d2 = vertices[id2].p-p; d2.normalize();
+            if(fabs(d1.dot(d2))>0.999) return true;
+            vec3f n;
+            n.cross(d1,d2);
+            n.normalize();
+            deleted[k]=0;
+            if(n.dot(normals[tid])<0.2) return true;
+        }
+        return false;
+    }
+
+    // update_uvs
+
+    void update_uvs(int i0,const Vertex &v,const vec3f &p,std::vector<int> &deleted)
+    {
+        (void)i0; // unused
+        for(size_t k = 0; k < v.tcount; ++k)
+        {
+            Ref &r=refs[v.tstart+k];
+            Triangle &t=triangles[r.tid];
+            if(t.deleted)continue;
+            if(deleted[k])continue;
+            vec3f p1=vertices[t.v[0]].p;
+            vec3f p2=vertices[t.v[1]].p;
+            vec3f p3=vertices[t.v[2]].p;
+            uvs[r.tid].uv[r.tvertex] = interpolate(p,p1,p2,p3,uvs[r.tid].uv);
+        }
+    }
+
+    // Interpolate the attributes of vertex i0 and i1 at p, before i1 is
+    // collapsed into i0. Only the two vertices are accessed, so it is safe
+    // in the parallel collapse pass.
+
+    void update_vertex_attributes(int i0,int i1,const vec3f &p)
+    {
+        const vec3f &p0=vertices[i0].p;
+        vec3f e=vertices[i1].p-p0;
+        double length2=e.dot(e);
+        double w=length2>0 ? (p-p0).dot(e)/length2 : 0.5;
+        w=std::min(std::max(w,0.0),1.0);
+        size_t n=vertices.size();
+        float *a=vertex_attributes.data();
+        for(int c = 0; c < vertex_attribute_components; ++c, a += n)
+        {
+            if(!vertex_attribute_discrete.empty() && vertex_attribute_discrete[c]) continue;
+            a[i0]=float(a[i0]+w*(a[i1]-a[i0]));
+        }
+    }
+
+    // Update triangle connections and edge error after a edge is collapsed
+
+    void update_triangles(int i0,Vertex &v,std::vector<int> &deleted,int &deleted_triangles,std::vector<Ref> &new_refs)
+    {
+        for(size_t k = 0; k < v.tcount; ++k)
+        {
+            Ref &r=refs[v.tstart+k];
+            Triangle &t=triangles[r.tid];
+            if(t.deleted)continue;
+            if(deleted[k])
+            {
+                t.deleted=1;
+                deleted_triangles++;
+                continue;
+            }
+            t.v[r.tvertex]=i0;
+            t.dirty=1;
+            calculate_error3(t);
+            new_refs.push_back(r);
+        }
+    }
+
+    // compact triangles, compute edge error and build reference list
+
+    void update_mesh(int iteration, bool verbose=false)
+    {
+        if(iteration>0) // compact triangles
+        {
+            compact_triangles();
+        }
+        //
+        // Init Quadrics by Plane & Edge Errors
+        //
+        // required at the beginning ( iteration == 0 )
+        // recomputing during the simplification is not required,
+        // but mostly improves the result for closed meshes
+        //
+        bool parallel = thread_count() > 1 && triangles.size() >= (size_t)parallel_min_triangles;
+        std::vector<double> plane_d;
+        if( iteration == 0 )
+        {
+            normals.resize(triangles.size());
+            plane_d.resize(triangles.size());
+            parallel_for(triangles.size(), [&](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; ++i)
+                {
+                    Triangle &t = triangles[i];
+                    vec3f n,p[3];
+                    for(size_t j: {0, 1, 2})
+                    {
+                        p[j] = vertices[t.v[j]].p;
+                    }
+                    n.cross(p[1]-p[0],p[2]-p[0]);
+                    n.normalize();
+                    normals[i]=n;
+                    plane_d[i]=-n.dot(p[0]);
+                }
+            });
+            if(!parallel)
+            {
+                for(Vertex& v: vertices)
+                {
+                    v.q = SymetricMatrix(0.0);
+                }
+                for(size_t i = 0; i < triangles.size(); ++i)
+                {
+                    const vec3f &n = normals[i];
+                    SymetricMatrix plane(n.x,n.y,n.z,plane_d[i]);
+                    for(size_t j: {0, 1, 2})
+                    {
+                        vertices[triangles[i].v[j]].q += plane;
+                    }
+                }
             }
+        }
 
-            for(Triangle& t: triangles)
+        // Init Reference ID list
+        update_refs();
+
+        if( iteration == 0 )
+        {
+            // With several threads each vertex sums the planes of its
+            // triangles. The references are sorted by triangle id, so the
+            // sums are the same as when adding the planes triangle by triangle.
+            if(parallel)
             {
-                vec3f n,p[3];
-                for(size_t j: {0, 1, 2})
+                parallel_for(vertices.size(), [&](size_t begin, size_t end)
+                {
+                    for(size_t i = begin; i < end; ++i)
+                    {
+                        Vertex &v = vertices[i];
+                        v.q = SymetricMatrix(0.0);
+                        for(size_t k = 0; k < v.tcount; ++k)
+                        {
+                            int tid = refs[v.tstart+k].tid;
+                            const vec3f &n = normals[tid];
+                            v.q += SymetricMatrix(n.x,n.y,n.z,plane_d[tid]);
+                        }
+                    }
+                });
+            }
+            if(border_weight > 0 || (feature_angle > 0 && feature_weight > 0))
+            {
+                add_constraint_planes();
+            }
+            parallel_for(triangles.size(), [this](size_t begin, size_t end)
+            {
+                for(size_t i = begin; i < end; ++i)
                 {
-                    p[j] = vertices[t.v[j]].p;
+                    // Calc Edge Error
+                    calculate_error3(triangles[i]);
                 }
-                n.cross(p[1]-p[0],p[2]-p[0]);
-                n.normalize();
-                t.n=n;
-                for(size_t j: {0, 1, 2})
+            });
+        }
+
+        // Identify boundary : vertices[].border=0,1
+        if( iteration == 0 )
+        {
+            identify_border();
+            if(verbose)
+            {
+                int border_count=0;
+                for(Vertex& v: vertices) { border_count+=v.border; }
+                printf("border vertices %d\n", border_count);
+            }
+        }
+    }
+
+    // Boundary and feature constraint quadrics (as in Garland and Heckbert).
+    // For each border edge and feature edge of a triangle, a plane through
+    // the edge and perpendicular to the triangle is added to the quadrics of
+    // the edge vertices, so that moving them off the border or crease line
+    // increases the error. Each vertex gathers the planes of its own
+    // triangles, the result does not depend on the number of threads.
+    // The edges of the triangles around a vertex (other vertex, triangle)
+    // are sorted, so the triangles sharing an edge are found in
+    // O(valence log valence) as in identify_border.
+
+    void add_constraint_planes()
+    {
+        double feature_cos = feature_angle > 0 ? cos(feature_angle*3.14159265358979323846/180.0) : -2;
+        parallel_for(vertices.size(), [&](size_t begin, size_t end)
+        {
+            // (other vertex, 2*k+s-1) of edge s of the k-th triangle
+            std::vector<std::pair<int,int>> edges;
+            // the triangle sharing the edge, -1 for a border edge and -2
+            // if more than one triangle shares it
+            std::vector<int> neighbors;
+            for(size_t i = begin; i < end; ++i)
+            {
+                Vertex &v = vertices[i];
+                edges.clear();
+                for(size_t k = 0; k < v.tcount; ++k)
+                {
+                    const Ref &r = refs[v.tstart+k];
+                    const Triangle &t = triangles[r.tid];
+                    for(int s: {1, 2}) { edges.push_back(std::make_pair(t.v[(r.tvertex+s)%3], int(2*k+s-1))); }
+                }
+                std::sort(edges.begin(), edges.end());
+                neighbors.assign(edges.size(), -1);
+                for(size_t j = 0; j < edges.size(); )
+                {
+                    // a triangle may use the other vertex twice if it is
+                    // degenerate, it is counted once
+                    size_t run=j+1, triangle_count=1;
+                    for(; run<edges.size() && edges[run].first==edges[j].first; run++)
+                    {
+                        if(edges[run].second/2 != edges[run-1].second/2) triangle_count++;
+                    }
+                    if(triangle_count == 2)
+                    {
+                        int first=edges[j].second/2, last=edges[run-1].second/2;
+                        for(size_t e = j; e < run; ++e)
+                        {
+                            int k=edges[e].second/2;
+                            neighbors[edges[e].second]=refs[v.tstart+(k == first ? last : first)].tid;
+                        }
+                    }
+                    else if(triangle_count > 2)
+                    {
+                        for(size_t e = j; e < run; ++e) { neighbors[edges[e].second]=-2; }
+                    }
+                    j=run;
+                }
+                for(size_t k = 0; k < v.tcount; ++k)
                 {
-                    vertices[t.v[j]].q = vertices[t.v[j]].q+SymetricMatrix(n.x,n.y,n.z,-n.dot(p[0]));
+                    const Ref &r = refs[v.tstart+k];
+                    const Triangle &t = triangles[r.tid];
+                    for(int s: {1, 2})
+                    {
+                        int other = t.v[(r.tvertex+s)%3];
+                        int neighbor = neighbors[2*k+s-1];
+                        double weight = 0;
+                        if(neighbor == -1) weight = border_weight;
+                        else if(neighbor >= 0 && normals[r.tid].dot(normals[neighbor]) < feature_cos) weight = feature_weight;
+                        if(weight <= 0) continue;
+                        vec3f n;
+                        n.cross(vertices[other].p-v.p, normals[r.tid]);
+                        double length = n.length();
+                        if(length <= 0) continue;
+                        n = n*(sqrt(weight)/length);
+                        v.q += SymetricMatrix(n.x,n.y,n.z,-n.dot(v.p));
+                    }
                 }
             }
+        });
+    }
+
+    // Build the reference list: vertices[].tstart/tcount index the
+    // triangles around each vertex in refs, ordered by triangle id
+
+    void update_refs()
+    {
+        refs.resize(triangles.size()*3);
+        int thread_n = thread_count();
+        if(thread_n <= 1 || triangles.size() < (size_t)parallel_min_triangles)
+        {
+            for(Vertex& v: vertices)
+            {
+                v.tstart=0;
+                v.tcount=0;
+            }
             for(Triangle& t: triangles)
             {
-                // Calc Edge Error
-                vec3f p;
+                for(size_t j: {0, 1, 2}) { vertices[t.v[j]].tcount++; }
+            }
+            int tstart=0;
+            for(Vertex& v: vertices)
+            {
+                v.tstart=tstart;
+                tstart+=v.tcount;
+                v.tcount=0;
+            }
+            for (size_t i = 0; i < triangles.size(); ++i)
+            {
+                Triangle &t = triangles[i];
                 for(size_t j: {0, 1, 2})
                 {
-                    t.err[j] = calculate_error(t.v[j],t.v[(j+1)%3],p);
+                    Vertex &v=vertices[t.v[j]];
+                    refs[v.tstart+v.tcount].tid=i;
+                    refs[v.tstart+v.tcount].tvertex=j;
+                    v.tcount++;
                 }
-                t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
             }
+            return;
         }
 
-        // Init Reference ID list
+        // Count the triangles of each vertex
+        std::vector<std::atomic<int>> cursor(vertices.size());
+        parallel_for(triangles.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                for(int j: {0, 1, 2}) { cursor[triangles[i].v[j]].fetch_add(1, std::memory_order_relaxed); }
+            }
+        });
+
+        // Prefix sum over contiguous vertex blocks, one block per thread
+        size_t block = (vertices.size()+thread_n-1)/thread_n;
+        std::vector<int> block_start(thread_n+1, 0);
+        run_threads([&](int b)
+        {
+            size_t end = std::min(vertices.size(), (b+1)*block);
+            int sum = 0;
+            for(size_t i = b*block; i < end; ++i) { sum += cursor[i].load(std::memory_order_relaxed); }
+            block_start[b+1] = sum;
+        });
+        for(int b = 0; b < thread_n; ++b) { block_start[b+1] += block_start[b]; }
+        run_threads([&](int b)
+        {
+            size_t end = std::min(vertices.size(), (b+1)*block);
+            int tstart = block_start[b];
+            for(size_t i = b*block; i < end; ++i)
+            {
+                int count = cursor[i].load(std::memory_order_relaxed);
+                vertices[i].tstart = tstart;
+                vertices[i].tcount = count;
+                cursor[i].store(tstart, std::memory_order_relaxed);
+                tstart += count;
+            }
+        });
+
+        // Scatter, then restore the triangle order within each vertex
+        parallel_for(triangles.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                for(int j: {0, 1, 2})
+                {
+                    Ref &r = refs[cursor[triangles[i].v[j]].fetch_add(1, std::memory_order_relaxed)];
+                    r.tid = i;
+                    r.tvertex = j;
+                }
+            }
+        });
+        parallel_for(vertices.size(), [&](size_t begin, size_t end)
+        {
+            for(size_t i = begin; i < end; ++i)
+            {
+                Ref *r = &refs[vertices[i].tstart];
+                std::sort(r, r+vertices[i].tcount, [](const Ref &a, const Ref &b)
+                {
+                    return a.tid < b.tid || (a.tid == b.tid && a.tvertex < b.tvertex);
+                });
+            }
+        });
+    }
+
+    // A vertex is on the border if one of its edges is used by a single
+    // triangle. The vertex ids of the triangles around each vertex are
+    // sorted, so an id occurring only once (a border edge) is found in
+    // O(valence log valence) instead of the quadratic search of the original
+    // code, which was very slow on high valence vertices. Each vertex only
+    // writes its own flag, so vertices are processed in parallel.
+
+    void identify_border()
+    {
+        parallel_for(vertices.size(), [this](size_t begin, size_t end)
+        {
+            std::vector<int> ids;
+            for(size_t i = begin; i < end; ++i)
+            {
+                Vertex &v=vertices[i];
+                ids.clear();
+                for(size_t j = 0; j < v.tcount; ++j)
+                {
+                    const Triangle &t=triangles[refs[v.tstart+j].tid];
+                    ids.insert(ids.end(), t.v, t.v+3);
+                }
+                std::sort(ids.begin(), ids.end());
+                v.border=0;
+                for(size_t j = 0; j < ids.size(); )
+                {
+                    size_t run=j+1;
+                    while(run<ids.size() && ids[run]==ids[j]) run++;
+                    if(run-j == 1)
+                    {
+                        v.border=1;
+                        break;
+                    }
+                    j=run;
+                }
+            }
+        });
+    }
+
+    // Finally compact mesh before exiting
+
+    void compact_mesh()
+    {
+        compact_triangles();
         for(Vertex& v: vertices)
         {
-            v.tstart=0;
-            v.tcount=0;
+            v.tcount = 0;
         }
         for(Triangle& t: triangles)
         {
-            for(size_t j: {0, 1, 2}) { vertices[t.v[j]].tcount++; }
+            for(size_t j: {0, 1, 2}) { vertices[t.v[j]].tcount=1; }
         }
-        int tstart=0;
+        int dst=0;
         for(Vertex& v: vertices)
         {
-            v.tstart=tstart;
-            tstart+=v.tcount;
-            v.tcount=0;
+            if(v.tcount == 0)
+            {
+                continue;
+            }
+            v.tstart=dst;
+            vertices[dst].p=v.p;
+            dst++;
+        }
+        for(Triangle& t: triangles)
+        {
+            for(size_t j: {0, 1, 2}) { t.v[j]=vertices[t.v[j]].tstart; }
+        }
+        if(vertex_attribute_components)
+        {
+            // in place, the new index of a vertex is never above the old one
+            size_t n=vertices.size();
+            float *a=vertex_attributes.data();
+            for(size_t c = 0; c < (size_t)vertex_attribute_components; ++c)
+            {
+                for(size_t i = 0; i < n; ++i)
+                {
+                    if(vertices[i].tcount) a[c*dst+vertices[i].tstart]=a[c*n+i];
+                }
+            }
+            vertex_attributes.resize(vertex_attribute_components*(size_t)dst);
+        }
+        if(track_vertex_origin)
+        {
+            vertex_origin.resize(dst);
+            for(size_t i = 0; i < vertices.size(); ++i)
+            {
+                if(vertices[i].tcount) vertex_origin[vertices[i].tstart]=int(i);
+            }
         }
+        vertices.resize(dst);
+    }
 
-        // Write References
-        refs.resize(triangles.size()*3);
-        for (size_t i = 0; i < triangles.size(); ++i)
+    // Remove deleted triangles (along with their side array entries)
+
+    void compact_triangles()
+    {
+        size_t dst=0;
+        for(size_t i = 0; i < triangles.size(); ++i)
         {
-            Triangle &t = triangles[i];
-            for(size_t j: {0, 1, 2})
+            if(triangles[i].deleted)
             {
-                Vertex &v=vertices[t.v[j]];
-                refs[v.tstart+v.tcount].tid=i;
-                refs[v.tstart+v.tcount].tvertex=j;
-                v.tcount++;
+                continue;
             }
+            triangles[dst] = triangles[i];
+            if(!normals.empty()) normals[dst] = normals[i];
+            if(!uvs.empty()) uvs[dst] = uvs[i];
+            if(!triangle_materials.empty()) triangle_materials[dst] = triangle_materials[i];
+            dst++;
         }
+        triangles.resize(dst);
+        if(!normals.empty()) normals.resize(dst);
+        if(!uvs.empty()) uvs.resize(dst);
+        if(!triangle_materials.empty()) triangle_materials.resize(dst);
+    }
 
-        // Identify boundary : vertices[].border=0,1
-        if( iteration == 0 )
+    // Remove the references to deleted triangles, and to triangles that no
+    // longer use the vertex (those of the vertices removed by collapses), so
+    // that refs does not keep growing when collapses append to it. The
+    // triangles are not moved, so their ids stay valid.
+
+    void compact_refs()
+    {
+        std::vector<Ref> compacted;
+        compacted.reserve(refs.size()/2);
+        for(size_t i = 0; i < vertices.size(); ++i)
+        {
+            Vertex &v=vertices[i];
+            size_t tstart=compacted.size();
+            for(size_t k = 0; k < v.tcount; ++k)
+            {
+                const Ref &r=refs[v.tstart+k];
+                const Triangle &t=triangles[r.tid];
+                if(!t.deleted && t.v[r.tvertex]==int(i)) compacted.push_back(r);
+            }
+            v.tstart=int(tstart);
+            v.tcount=compacted.size()-tstart;
+        }
+        refs.swap(compacted);
+    }
+
+    // Error between vertex and Quadric
+
+    double vertex_error(const SymetricMatrix &q, double x, double y, double z) const
+    {
+        return quadric_error(q.m, x, y, z);
+    }
+
+    // Error for one edge
+
+    double calculate_error(int id_v1, int id_v2, vec3f &p_result) const
+    {
+        // compute interpolated vertex
+
+        SymetricMatrix q = vertices[id_v1].q + vertices[id_v2].q;
+        bool   border = vertices[id_v1].border & vertices[id_v2].border;
+        double error=0;
+        double det = quadric_det(q.m);
+        if ( det != 0 && !border )
+        {
+
+            // q_delta is invertible
+            quadric_solve(q.m, det, p_result.x, p_result.y, p_result.z);
+            if(volume_preservation) constrain_volume(q, det, id_v1, id_v2, p_result);
+
+            error = vertex_error(q, p_result.x, p_result.y, p_result.z);
+        }
+        else
+        {
+            // det = 0 -> try to find best result
+            vec3f p1=vertices[id_v1].p;
+            vec3f p2=vertices[id_v2].p;
+            vec3f p3=(p1+p2)/2;
+            double error1 = vertex_error(q, p1.x,p1.y,p1.z);
+            double error2 = vertex_error(q, p2.x,p2.y,p2.z);
+            double error3 = vertex_error(q, p3.x,p3.y,p3.z);
+            error = min(error1, min(error2, error3));
+            if (error1 == error) p_result=p1;
+            if (error2 == error) p_result=p2;
+            if (error3 == error) p_result=p3;
+        }
+        return error;
+    }
+
+    // Move the minimum p of quadric q (with determinant det) to the minimum
+    // on the plane g.x=d where the volume swept by the triangles around the
+    // edge is zero: for each triangle of the two vertices (once if it has
+    // both) with normal n=(p1-p0)x(p2-p0), the signed volume of the
+    // tetrahedron with the new vertex x is (n.x-n.p0)/6. p-mu*w with
+    // w=A^-1*g (A is the 3x3 part of q) satisfies g.p=d for
+    // mu=(g.p-d)/(g.w).
+
+    void constrain_volume(const SymetricMatrix &q, double det, int id_v1, int id_v2, vec3f &p) const
+    {
+        vec3f g(0.0, 0.0, 0.0);
+        double d=0, area=0;
+        for(int id: {id_v1, id_v2})
+        {
+            const Vertex &v=vertices[id];
+            for(size_t k = 0; k < v.tcount; ++k)
+            {
+                const Triangle &t=triangles[refs[v.tstart+k].tid];
+                if(t.deleted) continue;
+                if(id == id_v2 && (t.v[0] == id_v1 || t.v[1] == id_v1 || t.v[2] == id_v1)) continue;
+                const vec3f &p0=vertices[t.v[0]].p;
+                vec3f n;
+                n.cross(vertices[t.v[1]].p-p0, vertices[t.v[2]].p-p0);
+                g=g+n;
+                d+=n.dot(p0);
+                area+=sqrt(n.dot(n));
+            }
+        }
+        // no constraint if the normals cancel out (e.g. flat or closed around the edge)
+        if(g.dot(g) <= 1e-12*area*area) return;
+        // solve A*w=g, quadric_solve gives -A^-1*b for b=(q[3],q[6],q[8])
+        SymetricMatrix qg(q);
+        qg.m[3]=-g.x; qg.m[6]=-g.y; qg.m[8]=-g.z;
+        vec3f w;
+        quadric_solve(qg.m, det, w.x, w.y, w.z);
+        double gw=g.dot(w);
+        if(!(fabs(gw) > 0 && fabs(gw) < DBL_MAX)) return;
+        double mu=(g.dot(p)-d)/gw;
+        p=p-w*mu;
+    }
+
+    // Errors of the three edges of a triangle (err[0..2]) and their minimum
+    // (err[3]). The edges are evaluated together, one SIMD lane per edge,
+    // with the same result as calling calculate_error for each edge.
+
+    void calculate_error3(Triangle &t) const
+    {
+        if(volume_preservation)
+        {
+            // constrained minimum, edge by edge
+            vec3f p;
+            for(int j = 0; j < 3; ++j) { t.err[j]=calculate_error(t.v[j], t.v[(j+1)%3], p); }
+            t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
+            return;
+        }
+        const Vertex &a=vertices[t.v[0]], &b=vertices[t.v[1]], &c=vertices[t.v[2]];
+        // lane j: edge from vertex j to vertex j+1 (the 4th lane is unused)
+        SymetricMatrix qab = a.q + b.q, qbc = b.q + c.q, qca = c.q + a.q;
+        dvec4 q[10];
+        for(int i = 0; i < 10; ++i)
+        {
+            q[i] = dvec4::set(qab.m[i], qbc.m[i], qca.m[i], qca.m[i]);
+        }
+
+        // q_delta is invertible
+        dvec4 det=quadric_det(q);
+        dvec4 x, y, z;
+        quadric_solve(q, det, x, y, z);
+        double dets[4];
+        det.store(dets);
+        double solved[4];
+        quadric_error(q, x, y, z).store(solved);
+
+        const Vertex *v[3]={&a, &b, &c};
+        bool invertible[3];
+        for(int j = 0; j < 3; ++j)
+        {
+            bool border = v[j]->border & v[(j+1)%3]->border;
+            invertible[j] = ( dets[j] != 0 && !border );
+            t.err[j] = solved[j];
+        }
+        if(!invertible[0] || !invertible[1] || !invertible[2])
+        {
+            // det = 0 -> try to find best result
+            dvec4 x1=dvec4::set(a.p.x, b.p.x, c.p.x, c.p.x), x2=dvec4::set(b.p.x, c.p.x, a.p.x, a.p.x);
+            dvec4 y1=dvec4::set(a.p.y, b.p.y, c.p.y, c.p.y), y2=dvec4::set(b.p.y, c.p.y, a.p.y, a.p.y);
+            dvec4 z1=dvec4::set(a.p.z, b.p.z, c.p.z, c.p.z), z2=dvec4::set(b.p.z, c.p.z, a.p.z, a.p.z);
+            double error1[4], error2[4], error3[4];
+            quadric_error(q, x1, y1, z1).store(error1);
+            quadric_error(q, x2, y2, z2).store(error2);
+            dvec4 half=dvec4::broadcast(2);
+            quadric_error(q, (x1+x2)/half, (y1+y2)/half, (z1+z2)/half).store(error3);
+            for(int j = 0; j < 3; ++j)
+            {
+                if(!invertible[j]) t.err[j] = min(error1[j], min(error2[j], error3[j]));
+            }
+        }
+        t.err[3]=min(t.err[0],min(t.err[1],t.err[2]));
+    }
+
+    // OBJ writing. Lines are formatted in blocks on the simplifier threads,
+    // each block is written with a single fwrite.
+
+    // Same output as printf("%g", x). The 6 significant digits are taken
+    // from the rounded scaled value, values that are too close to a
+    // rounding boundary for this to be exact are passed to snprintf.
+    static char *format_g(char *out, double x)
+    {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        double a = fabs(x);
+        if(a == 0)
+        {
+            if(signbit(x)) *out++ = '-';
+            *out++ = '0';
+            return out;
+        }
+        if(!(a >= 1e-300 && a <= 1e300)) return out + snprintf(out, 32, "%g", x);
+        int e;
+        if(a >= 1e-22 && a < 1e22)
+        {
+            e = 0;
+            if(a >= 1) { while(e < 22 && a >= powers[e+1]) e++; }
+            else { while(a*powers[-e] < 1) e--; }
+        }
+        else
+        {
+            e = (int)floor(log10(a));
+        }
+        long m;
+        for(;;)
+        {
+            int k = 5-e;
+            double scaled;
+            if(k >= 0) scaled = (k <= 22) ? a*powers[k] : a*pow(10.0, k);
+            else scaled = (k >= -22) ? a/powers[-k] : a/pow(10.0, -k);
+            double frac = scaled-floor(scaled);
+            if(fabs(frac-0.5) < 1e-7) return out + snprintf(out, 32, "%g", x);
+            m = (long)floor(scaled) + (frac > 0.5 ? 1 : 0);
+            // correct the estimated exponent
+            if(m < 100000) e--;
+            else if(scaled >= 1000000) e++;
+            else break;
+        }
+        if(m == 1000000)
+        {
+            // rounded up to the next power of 10
+            m = 100000;
+            e++;
+        }
+        char digits[6];
+        for(int i = 5; i >= 0; --i)
         {
-            std::vector<int> vcount,vids;
+            digits[i] = char('0'+m%10);
+            m /= 10;
+        }
+        int n = 6;
+        while(n > 1 && digits[n-1] == '0') n--;
+        if(x < 0) *out++ = '-';
+        if(e >= -4 && e < 6)
+        {
+            if(e >= 0)
+            {
+                for(int i = 0; i <= e; ++i) *out++ = digits[i];
+                if(n > e+1) *out++ = '.';
+                for(int i = e+1; i < n; ++i) *out++ = digits[i];
+            }
+            else
+            {
+                *out++ = '0';
+                *out++ = '.';
+                for(int i = 0; i < -e-1; ++i) *out++ = '0';
+                for(int i = 0; i < n; ++i) *out++ = digits[i];
+            }
+        }
+        else
+        {
+            *out++ = digits[0];
+            if(n > 1) *out++ = '.';
+            for(int i = 1; i < n; ++i) *out++ = digits[i];
+            *out++ = 'e';
+            *out++ = e < 0 ? '-' : '+';
+            int ae = abs(e);
+            if(ae >= 100) *out++ = char('0'+ae/100);
+            *out++ = char('0'+ae/10%10);
+            *out++ = char('0'+ae%10);
+        }
+        return out;
+    }
+
+    static char *format_int(char *out, int value)
+    {
+        char digits[12];
+        int n = 0;
+        unsigned int v = value < 0 ? 0u-(unsigned int)value : (unsigned int)value;
+        do
+        {
+            digits[n++] = char('0'+v%10);
+            v /= 10;
+        } while(v);
+        if(value < 0) *out++ = '-';
+        while(n) *out++ = digits[--n];
+        return out;
+    }
 
-            for(Vertex& v: vertices)
-            {
-                v.border=0;
-            }
+    static char *format_text(char *out, const char *text)
+    {
+        while(*text) *out++ = *text++;
+        return out;
+    }
 
-            for(Vertex& v: vertices)
+    // Format items [0,n) with format(begin, end, out), which returns the end
+    // of the formatted text and writes at most line_size bytes per item.
+    // Blocks of items are formatted in parallel and written in order.
+    template<typename Function>
+    bool write_blocks(FILE *file, size_t n, size_t block, size_t line_size, Function format)
+    {
+        size_t block_count = (n+block-1)/block;
+        size_t batch = 2*size_t(thread_count());
+        std::vector<std::vector<char> > buffers(std::min(batch, block_count));
+        std::vector<size_t> sizes(buffers.size());
+        for(size_t first = 0; first < block_count; first += batch)
+        {
+            size_t count = std::min(batch, block_count-first);
+            std::atomic<size_t> next(0);
+            run_threads([&](int)
             {
-                vcount.clear();
-                vids.clear();
-                for(size_t j = 0; j < v.tcount; ++j)
+                for(size_t k = next++; k < count; k = next++)
                 {
-                    int k=refs[v.tstart+j].tid;
-                    Triangle &t=triangles[k];
-                    for(size_t k: {0, 1, 2})
-                    {
-                        size_t ofs=0;
-                        int id=t.v[k];
-                        while(ofs<vcount.size())
-                        {
-                            if(vids[ofs]==id)break;
-                            ofs++;
-                        }
-                        if(ofs==vcount.size())
-                        {
-                            vcount.push_back(1);
-                            vids.push_back(id);
-                        }
-                        else
-                            vcount[ofs]++;
-                    }
+                    size_t begin = (first+k)*block;
+                    size_t end = std::min(begin+block, n);
+                    std::vector<char> &buffer = buffers[k];
+                    buffer.resize((end-begin)*line_size);
+                    sizes[k] = format(begin, end, buffer.data())-buffer.data();
                 }
-                for(size_t j = 0; j < vcount.size(); ++j)
-                {
-                    if(vcount[j] == 1)
-                    {
-                        vertices[vids[j]].border = 1;
-                    }
-               }
+            });
+            for(size_t k = 0; k < count; ++k)
+            {
+                if(fwrite(buffers[k].data(), 1, sizes[k], file) != sizes[k]) return false;
             }
         }
+        return true;
     }
 
-    // Finally compact mesh before exiting
+    // OBJ parsing. Lines are parsed in place in the file buffer, which ends
+    // with a newline and a zero byte.
 
-    void compact_mesh()
+    struct ObjChunk
     {
-        int dst=0;
-        for(Vertex& v: vertices)
+        const char *begin, *end;
+        // counted in the first pass
+        size_t vertex_count = 0, vt_count = 0, triangle_count = 0;
+        std::vector<std::string> usemtl;
+        std::string mtllib;
+        bool has_mtllib = false;
+        // position of the chunk in the arrays, material selected before it
+        size_t vertex_start = 0, vt_start = 0, triangle_start = 0;
+        std::vector<int> usemtl_id;
+        int material = -1;
+        // results of the second pass
+        bool has_uv = false, has_material = false;
+        const char *error = nullptr; // first line that could not be parsed
+    };
+
+    static bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    static const char *skip_blank(const char *s)
+    {
+        while(is_blank(*s)) s++;
+        return s;
+    }
+
+    // A NUL byte inside the text also ends a line (as it does for fgets), so
+    // that the parsers move past it. The buffers are terminated by a newline
+    // before the final NUL.
+    static bool is_line_end(char c) { return c == '\n' || c == 0; }
+
+    static const char *next_line(const char *s)
+    {
+        while(!is_line_end(*s)) s++;
+        return s+1;
+    }
+
+    static bool is_keyword(const char *s, const char *keyword, size_t length)
+    {
+        return strncmp(s, keyword, length) == 0 && (is_blank(s[length]) || is_line_end(s[length]));
+    }
+
+    // Rest of the line without leading and trailing whitespace
+    static std::string line_text(const char *s)
+    {
+        s = skip_blank(s);
+        const char *end = s;
+        while(!is_line_end(*end)) end++;
+        while(end > s && is_blank(end[-1])) end--;
+        return std::string(s, end);
+    }
+
+    static bool parse_int(const char *&s, int &value)
+    {
+        const char *p = s;
+        bool negative = (*p == '-');
+        if(*p == '-' || *p == '+') p++;
+        if(*p < '0' || *p > '9') return false;
+        long long v = 0;
+        for(; *p >= '0' && *p <= '9'; ++p)
         {
-            v.tcount = 0;
+            v = v*10 + (*p-'0');
+            if(v > INT_MAX) return false;
         }
-        for(Triangle& t: triangles)
+        value = negative ? -int(v) : int(v);
+        s = p;
+        return true;
+    }
+
+    // Numbers with up to 19 significant digits and a small exponent are
+    // converted exactly (m*10^e with m < 2^53 and |e| <= 22 is correctly
+    // rounded), anything else is passed to strtod. Same result as strtod.
+    static bool parse_double(const char *&s, double &value)
+    {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        if(*s == '\n' || *s == 0 || is_blank(*s)) return false;
+        const char *p = s;
+        bool negative = (*p == '-');
+        if(*p == '-' || *p == '+') p++;
+        unsigned long long mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool exact = true, any = false;
+        for(; *p >= '0' && *p <= '9'; ++p, any = true)
         {
-            if(t.deleted)
+            if(digits < 19)
             {
-                continue;
+                mantissa = mantissa*10 + (*p-'0');
+                if(mantissa) digits++;
+            }
+            else
+            {
+                exact = false;
             }
-            triangles[dst++]=t;
-            for(size_t j: {0, 1, 2}) { vertices[t.v[j]].tcount=1; }
         }
-        triangles.resize(dst);
-        dst=0;
-        for(Vertex& v: vertices)
+        if(*p == '.')
         {
-            if(v.tcount == 0)
+            for(++p; *p >= '0' && *p <= '9'; ++p, any = true)
             {
-                continue;
+                if(digits < 19)
+                {
+                    mantissa = mantissa*10 + (*p-'0');
+                    if(mantissa) digits++;
+                    exponent--;
+                }
+                else
+                {
+                    exact = false;
+                }
             }
-            v.tstart=dst;
-            vertices[dst].p=v.p;
-            dst++;
         }
-        for(Triangle& t: triangles)
+        if(any && (*p == 'e' || *p == 'E'))
         {
-            for(size_t j: {0, 1, 2}) { t.v[j]=vertices[t.v[j]].tstart; }
+            const char *e = p+1;
+            bool negative_exponent = (*e == '-');
+            if(*e == '-' || *e == '+') e++;
+            if(*e >= '0' && *e <= '9')
+            {
+                int n = 0;
+                for(; *e >= '0' && *e <= '9'; ++e) { if(n < 10000) n = n*10 + (*e-'0'); }
+                exponent += negative_exponent ? -n : n;
+                p = e;
+            }
+            else
+            {
+                exact = false;
+            }
         }
-        vertices.resize(dst);
+        if(any && exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+        {
+            double v = double(mantissa);
+            v = exponent < 0 ? v/powers[-exponent] : v*powers[exponent];
+            value = negative ? -v : v;
+            s = p;
+            return true;
+        }
+        char *end;
+        value = strtod(s, &end);
+        if(end == s) return false;
+        s = end;
+        return true;
     }
 
-    // Error between vertex and Quadric
-
-    double vertex_error(SymetricMatrix q, double x, double y, double z)
+    static void report_obj_error(const char *line)
     {
-         return   q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x + q[4]*y*y
-              + 2*q[5]*y*z + 2*q[6]*y + q[7]*z*z + 2*q[8]*z + q[9];
+        printf("unrecognized sequence\n");
+        printf("%s\n", std::string(line, next_line(line)-line).c_str());
     }
 
-    // Error for one edge
-
-    double calculate_error(int id_v1, int id_v2, vec3f &p_result)
+    // First pass: count vertices, texture coordinates and triangles
+    static void count_obj_chunk(ObjChunk &chunk)
     {
-        // compute interpolated vertex
-
-        SymetricMatrix q = vertices[id_v1].q + vertices[id_v2].q;
-        bool   border = vertices[id_v1].border & vertices[id_v2].border;
-        double error=0;
-        double det = q.det(0, 1, 2, 1, 4, 5, 2, 5, 7);
-        if ( det != 0 && !border )
-        {
-
-            // q_delta is invertible
-            p_result.x = -1/det*(q.det(1, 2, 3, 4, 5, 6, 5, 7 , 8));    // vx = A41/det(q_delta)
-            p_result.y =  1/det*(q.det(0, 2, 3, 1, 5, 6, 2, 7 , 8));    // vy = A42/det(q_delta)
-            p_result.z = -1/det*(q.det(0, 1, 3, 1, 4, 6, 2, 5,  8));    // vz = A43/det(q_delta)
-
-            error = vertex_error(q, p_result.x, p_result.y, p_result.z);
-        }
-        else
+        for(const char *line = chunk.begin; line < chunk.end; line = next_line(line))
         {
-            // det = 0 -> try to find best result
-            vec3f p1=vertices[id_v1].p;
-            vec3f p2=vertices[id_v2].p;
-            vec3f p3=(p1+p2)/2;
-            double error1 = vertex_error(q, p1.x,p1.y,p1.z);
-            double error2 = vertex_error(q, p2.x,p2.y,p2.z);
-            double error3 = vertex_error(q, p3.x,p3.y,p3.z);
-            error = min(error1, min(error2, error3));
-            if (error1 == error) p_result=p1;
-            if (error2 == error) p_result=p2;
-            if (error3 == error) p_result=p3;
+            const char *s = skip_blank(line);
+            if(s[0] == 'v')
+            {
+                if(is_blank(s[1])) chunk.vertex_count++;
+                else if(s[1] == 't' && is_blank(s[2])) chunk.vt_count++;
+            }
+            else if(s[0] == 'f' && is_blank(s[1]))
+            {
+                int corners = 0;
+                for(s = skip_blank(s+1); !is_line_end(*s) && *s != '#'; s = skip_blank(s))
+                {
+                    while(!is_line_end(*s) && !is_blank(*s)) s++;
+                    corners++;
+                }
+                if(corners < 3)
+                {
+                    chunk.error = line;
+                    return;
+                }
+                chunk.triangle_count += corners-2;
+            }
+            else if(is_keyword(s, "usemtl", 6))
+            {
+                chunk.usemtl.push_back(line_text(s+6));
+            }
+            else if(is_keyword(s, "mtllib", 6))
+            {
+                chunk.mtllib = line_text(s+6);
+                chunk.has_mtllib = true;
+            }
         }
-        return error;
     }
 
-    char *trimwhitespace(char *str)
+    // Resolve a 1-based or negative (relative to count) index
+    static bool resolve_index(int index, size_t count, size_t total, int &result)
     {
-        char *end;
-
-        // Trim leading space
-        while(isspace((unsigned char)*str)) str++;
-
-        if(*str == 0)  // All spaces?
-        return str;
-
-        // Trim trailing space
-        end = str + strlen(str) - 1;
-        while(end > str && isspace((unsigned char)*end)) end--;
-
-        // Write new null terminator
-        *(end+1) = 0;
+        long long i = index > 0 ? (long long)index-1 : (long long)count+index;
+        if(index == 0 || i < 0 || i >= (long long)total) return false;
+        result = int(i);
+        return true;
+    }
 
-        return str;
+    // Second pass: parse the elements of a chunk into the arrays. Texture
+    // coordinates and their indices are stored if vts is not empty.
+    void parse_obj_chunk(ObjChunk &chunk, std::vector<vec3f> &vts, std::vector<int> &vt_index)
+    {
+        size_t vertex_i = chunk.vertex_start;
+        size_t vt_i = chunk.vt_start;
+        size_t triangle_i = chunk.triangle_start;
+        size_t usemtl_i = 0;
+        int material = chunk.material;
+        bool store_uv = !vts.empty();
+        size_t vt_total = store_uv ? vts.size() : size_t(INT_MAX);
+        for(const char *line = chunk.begin; line < chunk.end; line = next_line(line))
+        {
+            const char *s = skip_blank(line);
+            if(s[0] == 'v' && is_blank(s[1]))
+            {
+                vec3f &p = vertices[vertex_i++].p;
+                s = skip_blank(s+1);
+                if(!parse_double(s, p.x)) { chunk.error = line; return; }
+                s = skip_blank(s);
+                if(!parse_double(s, p.y)) { chunk.error = line; return; }
+                s = skip_blank(s);
+                if(!parse_double(s, p.z)) { chunk.error = line; return; }
+            }
+            else if(s[0] == 'v' && s[1] == 't' && is_blank(s[2]))
+            {
+                vec3f uv(0, 0, 0);
+                s = skip_blank(s+2);
+                if(!parse_double(s, uv.x)) { chunk.error = line; return; }
+                s = skip_blank(s);
+                if(parse_double(s, uv.y))
+                {
+                    s = skip_blank(s);
+                    parse_double(s, uv.z);
+                }
+                if(store_uv) vts[vt_i] = uv;
+                vt_i++;
+            }
+            else if(s[0] == 'f' && is_blank(s[1]))
+            {
+                // corners: first, previous and current (vertex, texture coordinate)
+                int v[3], vt[3];
+                int corner = 0;
+                for(s = skip_blank(s+1); !is_line_end(*s) && *s != '#'; s = skip_blank(s), corner++)
+                {
+                    int k = std::min(corner, 2);
+                    int index, normal;
+                    vt[k] = -1;
+                    if(!parse_int(s, index) || !resolve_index(index, vertex_i, vertices.size(), v[k]))
+                    {
+                        chunk.error = line;
+                        return;
+                    }
+                    if(*s == '/')
+                    {
+                        s++;
+                        if(*s != '/')
+                        {
+                            if(!parse_int(s, index) || !resolve_index(index, vt_i, vt_total, vt[k]))
+                            {
+                                chunk.error = line;
+                                return;
+                            }
+                        }
+                        if(*s == '/')
+                        {
+                            s++;
+                            if(!is_blank(*s) && !is_line_end(*s) && !parse_int(s, normal))
+                            {
+                                chunk.error = line;
+                                return;
+                            }
+                        }
+                    }
+                    if(!is_blank(*s) && !is_line_end(*s) && *s != '#')
+                    {
+                        chunk.error = line;
+                        return;
+                    }
+                    if(corner < 2) continue;
+                    Triangle &t = triangles[triangle_i];
+                    t.v[0] = v[0];
+                    t.v[1] = v[1];
+                    t.v[2] = v[2];
+                    t.deleted = 0;
+                    t.dirty = 0;
+                    t.attr = 0;
+                    if(store_uv && vt[0] >= 0 && vt[1] >= 0 && vt[2] >= 0)
+                    {
+                        for(int j: {0, 1, 2}) { vt_index[3*triangle_i+j] = vt[j]; }
+                        t.attr |= TEXCOORD;
+                        chunk.has_uv = true;
+                    }
+                    if(!triangle_materials.empty())
+                    {
+                        triangle_materials[triangle_i] = material;
+                        chunk.has_material = chunk.has_material || material >= 0;
+                    }
+                    triangle_i++;
+                    // next triangle of the fan
+                    v[1] = v[2];
+                    vt[1] = vt[2];
+                }
+            }
+            else if(is_keyword(s, "usemtl", 6))
+            {
+                material = chunk.usemtl_id[usemtl_i++];
+            }
+        }
     }
 
+public:
     //Option : Load OBJ
-    void load_obj(const char* filename, bool process_uv=false){
+    //
+    // The file is read into memory with a single pass and split into chunks
+    // at line boundaries. A first parallel pass counts the elements of each
+    // chunk, so that all arrays are allocated once with their final size,
+    // then a second parallel pass parses each chunk into its part of the
+    // arrays. Polygons are fan-triangulated, negative (relative) indices and
+    // the v, v/vt, v//vn and v/vt/vn face formats are supported.
+    bool load_obj(const char* filename, bool process_uv=false){
         vertices.clear();
         triangles.clear();
+        refs.clear();
+        mtllib.clear();
+        materials.clear();
+        normals.clear();
+        uvs.clear();
+        triangle_materials.clear();
+        vertex_attribute_components = 0;
+        vertex_attributes.clear();
+        vertex_attribute_discrete.clear();
         //printf ( "Loading Objects %s ... \n",filename);
         FILE* fn;
-        if(filename==NULL)        return ;
-        if((char)filename[0]==0)    return ;
+        if(filename==NULL)        return false;
+        if((char)filename[0]==0)    return false;
         if ((fn = fopen(filename, "rb")) == NULL)
         {
             printf ( "File %s not found!\n" ,filename );
-            return;
+            return false;
+        }
+        std::vector<char> buffer;
+        size_t size = 0;
+        const size_t block = size_t(1) << 24;
+        for(;;)
+        {
+            buffer.resize(size+block);
+            size_t n = fread(&buffer[size], 1, block, fn);
+            size += n;
+            if(n < block) break;
+        }
+        fclose(fn);
+        // terminate the last line
+        buffer.resize(size+2);
+        buffer[size] = '\n';
+        buffer[size+1] = 0;
+
+        // Split at line boundaries
+        int thread_n = thread_count();
+        size_t chunk_size = std::max(size/(thread_n > 1 ? 4*thread_n : 1), size_t(1) << 20);
+        std::vector<ObjChunk> chunks;
+        for(const char *begin = &buffer[0], *end = begin+size+1; begin < end; )
+        {
+            ObjChunk chunk;
+            chunk.begin = begin;
+            chunk.end = (size_t(end-begin) <= chunk_size) ? end : next_line(begin+chunk_size-1);
+            chunks.push_back(chunk);
+            begin = chunk.end;
         }
-        char line[1000];
-        memset ( line,0,1000 );
-        int vertex_cnt = 0;
+        auto for_each_chunk = [&](const std::function<void(ObjChunk&)> &pass)
+        {
+            std::atomic<size_t> next_chunk(0);
+            run_threads([&](int)
+            {
+                for(size_t c = next_chunk++; c < chunks.size(); c = next_chunk++) { pass(chunks[c]); }
+            });
+        };
+
+        for_each_chunk([](ObjChunk &chunk) { count_obj_chunk(chunk); });
+
+        // Element ranges and materials of the chunks
+        size_t vertex_count = 0, vt_count = 0, triangle_count = 0;
         int material = -1;
         std::map<std::string, int> material_map;
-        std::vector<vec3f> uvs;
-        std::vector<std::vector<int> > uvMap;
-
-        while(fgets( line, 1000, fn ) != NULL)
+        for(ObjChunk &chunk: chunks)
         {
-            Vertex v;
-            vec3f uv;
-
-            if (strncmp(line, "mtllib", 6) == 0)
+            if(chunk.error)
             {
-                mtllib = trimwhitespace(&line[7]);
+                report_obj_error(chunk.error);
+                return false;
             }
-            if (strncmp(line, "usemtl", 6) == 0)
+            chunk.vertex_start = vertex_count;
+            chunk.vt_start = vt_count;
+            chunk.triangle_start = triangle_count;
+            vertex_count += chunk.vertex_count;
+            vt_count += chunk.vt_count;
+            triangle_count += chunk.triangle_count;
+            chunk.material = material;
+            for(const std::string &usemtl: chunk.usemtl)
             {
-                std::string usemtl = trimwhitespace(&line[7]);
                 if (material_map.find(usemtl) == material_map.end())
                 {
                     material_map[usemtl] = materials.size();
                     materials.push_back(usemtl);
                 }
                 material = material_map[usemtl];
+                chunk.usemtl_id.push_back(material);
             }
+            if(chunk.has_mtllib) mtllib = chunk.mtllib;
+        }
+
+        vertices.resize(vertex_count);
+        triangles.resize(triangle_count);
+        std::vector<vec3f> vts;
+        std::vector<int> vt_index;
+        if(process_uv && vt_count)
+        {
+            vts.resize(vt_count);
+            vt_index.resize(3*triangle_count);
+        }
+        if(!materials.empty())
+        {
+            triangle_materials.resize(triangle_count);
+        }
 
-            if ( line[0] == 'v' && line[1] == 't' )
+        for_each_chunk([&](ObjChunk &chunk) { parse_obj_chunk(chunk, vts, vt_index); });
+
+        bool has_uv = false, has_material = false;
+        for(ObjChunk &chunk: chunks)
+        {
+            if(chunk.error)
             {
-                if ( line[2] == ' ' )
-                {
-                    if(sscanf(line,"vt %lf %lf",
-                        &uv.x,&uv.y)==2)
-                    {
-                        uv.z = 0;
-                        uvs.push_back(uv);
-                    } else
-                    if(sscanf(line,"vt %lf %lf %lf",
-                        &uv.x,&uv.y,&uv.z)==3)
-                    {
-                        uvs.push_back(uv);
-                    }
-                }
+                report_obj_error(chunk.error);
+                return false;
             }
-            else if ( line[0] == 'v' )
+            has_uv = has_uv || chunk.has_uv;
+            has_material = has_material || chunk.has_material;
+        }
+        if(!has_material)
+        {
+            // materials were only selected after the last face
+            triangle_materials.clear();
+        }
+        if(has_uv)
+        {
+            uvs.resize(triangles.size());
+            parallel_for(triangles.size(), [&](size_t begin, size_t end)
             {
-                if ( line[1] == ' ' )
+                for(size_t i = begin; i < end; ++i)
                 {
-                    if(sscanf(line,"v %lf %lf %lf",
-                        &v.p.x,    &v.p.y,    &v.p.z)==3)
+                    if ( (triangles[i].attr & TEXCOORD) != TEXCOORD )
                     {
-                        vertices.push_back(v);
+                        continue;
                     }
-                }
-            }
-            int integers[9];
-            if ( line[0] == 'f' )
-            {
-                Triangle t;
-                bool tri_ok = false;
-                bool has_uv = false;
-
-                if(sscanf(line,"f %d %d %d",
-                    &integers[0],&integers[1],&integers[2])==3)
-                {
-                    tri_ok = true;
-                }else
-                if(sscanf(line,"f %d// %d// %d//",
-                    &integers[0],&integers[1],&integers[2])==3)
-                {
-                    tri_ok = true;
-                }else
-                if(sscanf(line,"f %d//%d %d//%d %d//%d",
-                    &integers[0],&integers[3],
-                    &integers[1],&integers[4],
-                    &integers[2],&integers[5])==6)
-                {
-                    tri_ok = true;
-                }else
-                if(sscanf(line,"f %d/%d/%d %d/%d/%d %d/%d/%d",
-                    &integers[0],&integers[6],&integers[3],
-                    &integers[1],&integers[7],&integers[4],
-                    &integers[2],&integers[8],&integers[5])==9)
-                {
-                    tri_ok = true;
-                    has_uv = true;
-                }
-                else
-                {
-                    printf("unrecognized sequence\n");
-                    printf("%s\n",line);
-                    while(1);
-                }
-                if ( tri_ok )
-                {
-                    t.v[0] = integers[0]-1-vertex_cnt;
-                    t.v[1] = integers[1]-1-vertex_cnt;
-                    t.v[2] = integers[2]-1-vertex_cnt;
-                    t.attr = 0;
-
-                    if ( process_uv && has_uv )
+                    for(size_t j: {0, 1, 2})
                     {
-                        std::vector<int> indices;
-                        indices.push_back(integers[6]-1-vertex_cnt);
-                        indices.push_back(integers[7]-1-vertex_cnt);
-                        indices.push_back(integers[8]-1-vertex_cnt);
-                        uvMap.push_back(indices);
-                        t.attr |= TEXCOORD;
+                        uvs[i].uv[j] = vts[vt_index[3*i+j]];
                     }
-
-                    t.material = material;
-                    //geo.triangles.push_back ( tri );
-                    triangles.push_back(t);
-                    //state_before = state;
-                    //state ='f';
-                }
-            }
-        }
-
-        if ( process_uv && uvs.size() )
-        {
-            for(size_t i = 0; i < triangles.size(); ++i)
-            {
-                Triangle& t = triangles[i];
-                for(size_t j: {0, 1, 2})
-                {
-                    t.uvs[j] = uvs[uvMap[i][j]];
                 }
-            }
+            });
         }
 
-        fclose(fn);
-
         //printf("load_obj: vertices = %lu, triangles = %lu, uvs = %lu\n", vertices.size(), triangles.size(), uvs.size() );
+        return true;
     } // load_obj()
 
     // Optional : Store as OBJ
 
-    void write_obj(const char* filename)
+    bool write_obj(const char* filename)
     {
         FILE *file=fopen(filename, "w");
-        int cur_material = -1;
-        bool has_uv = (triangles.size() && (triangles[0].attr & TEXCOORD) == TEXCOORD);
+        bool has_uv = (triangles.size() && (triangles[0].attr & TEXCOORD) == TEXCOORD && !uvs.empty());
 
         if (!file)
         {
             printf("write_obj: can't write data file \"%s\".\n", filename);
-            exit(0);
+            return false;
         }
         if (!mtllib.empty())
         {
             fprintf(file, "mtllib %s\n", mtllib.c_str());
         }
-        for(Vertex& v: vertices)
+        const size_t block = 16384;
+        bool ok = write_blocks(file, vertices.size(), block, 64, [this](size_t begin, size_t end, char *out)
         {
-            //fprintf(file, "v %lf %lf %lf\n", v.p.x, v.p.y, v.p.z);
-            fprintf(file, "v %g %g %g\n", v.p.x, v.p.y, v.p.z); //more compact: remove trailing zeros
-        }
-        if (has_uv)
+            for(size_t i = begin; i < end; ++i)
+            {
+                //fprintf(file, "v %lf %lf %lf\n", v.p.x, v.p.y, v.p.z);
+                // "v %g %g %g\n", more compact: remove trailing zeros
+                const vec3f &p = vertices[i].p;
+                out = format_text(out, "v ");
+                out = format_g(out, p.x);
+                *out++ = ' ';
+                out = format_g(out, p.y);
+                *out++ = ' ';
+                out = format_g(out, p.z);
+                *out++ = '\n';
+            }
+            return out;
+        });
+        if (ok && has_uv)
         {
-            for(Triangle& t: triangles)
+            ok = write_blocks(file, triangles.size(), block, 128, [this](size_t begin, size_t end, char *out)
             {
-                if(t.deleted)
+                for(size_t i = begin; i < end; ++i)
                 {
-                    continue;
+                    if(triangles[i].deleted)
+                    {
+                        continue;
+                    }
+                    // "vt %g %g\n" for each corner
+                    for(const vec3f &uv: uvs[i].uv)
+                    {
+                        out = format_text(out, "vt ");
+                        out = format_g(out, uv.x);
+                        *out++ = ' ';
+                        out = format_g(out, uv.y);
+                        *out++ = '\n';
+                    }
                 }
-                fprintf(file, "vt %g %g\n", t.uvs[0].x, t.uvs[0].y);
-                fprintf(file, "vt %g %g\n", t.uvs[1].x, t.uvs[1].y);
-                fprintf(file, "vt %g %g\n", t.uvs[2].x, t.uvs[2].y);
-            }
+                return out;
+            });
         }
-        int uv = 1;
-        for(Triangle& t: triangles)
+        if (ok)
         {
-            if(t.deleted)
-            {
-                continue;
-            }
-            if (t.material != cur_material)
-            {
-                cur_material = t.material;
-                fprintf(file, "usemtl %s\n", materials[t.material].c_str());
-            }
-            if (has_uv)
+            // Texture coordinate index and material before each block
+            std::vector<int> block_uv, block_material;
+            size_t material_length = 0;
+            for(const std::string &material: materials) { material_length = std::max(material_length, material.size()); }
+            int uv = 1;
+            int cur_material = -1;
+            for(size_t i = 0; i < triangles.size(); ++i)
             {
-                fprintf(file, "f %d/%d %d/%d %d/%d\n", t.v[0]+1, uv, t.v[1]+1, uv+1, t.v[2]+1, uv+2);
+                if(i % block == 0)
+                {
+                    block_uv.push_back(uv);
+                    block_material.push_back(cur_material);
+                }
+                if(triangles[i].deleted)
+                {
+                    continue;
+                }
                 uv += 3;
+                if(!triangle_materials.empty()) cur_material = triangle_materials[i];
             }
-            else
+            ok = write_blocks(file, triangles.size(), block, 96+material_length, [&](size_t begin, size_t end, char *out)
             {
-                fprintf(file, "f %d %d %d\n", t.v[0]+1, t.v[1]+1, t.v[2]+1);
-            }
-            //fprintf(file, "f %d// %d// %d//\n", t.v[0]+1, t.v[1]+1, t.v[2]+1); //more compact: remove trailing zeros
+                int block_uv_index = block_uv[begin/block];
+                int block_cur_material = block_material[begin/block];
+                for(size_t i = begin; i < end; ++i)
+                {
+                    Triangle &t = triangles[i];
+                    if(t.deleted)
+                    {
+                        continue;
+                    }
+                    int material = triangle_materials.empty() ? -1 : triangle_materials[i];
+                    if (material != block_cur_material && material >= 0)
+                    {
+                        // "usemtl %s\n"
+                        out = format_text(out, "usemtl ");
+                        out = format_text(out, materials[material].c_str());
+                        *out++ = '\n';
+                    }
+                    block_cur_material = material;
+                    *out++ = 'f';
+                    for(int j: {0, 1, 2})
+                    {
+                        // " %d/%d" with texture coordinates, " %d" otherwise
+                        *out++ = ' ';
+                        out = format_int(out, t.v[j]+1);
+                        if (has_uv)
+                        {
+                            *out++ = '/';
+                            out = format_int(out, block_uv_index+j);
+                        }
+                    }
+                    *out++ = '\n';
+                    if (has_uv)
+                    {
+                        block_uv_index += 3;
+                    }
+                    //fprintf(file, "f %d// %d// %d//\n", t.v[0]+1, t.v[1]+1, t.v[2]+1); //more compact: remove trailing zeros
+                }
+                return out;
+            });
         }
-        fclose(file);
+        if (fclose(file) != 0 || !ok)
+        {
+            printf("write_obj: can't write data file \"%s\".\n", filename);
+            return false;
+        }
+        return true;
     }
 };
 ///////////////////////////////////////////
+
+#endif
@@ -0,0 +1,634 @@
+// Performance and accuracy regression benchmark of the Decimation module.
+//
+// Synthetic meshes of the requested size are generated (a sphere, marching
+// cubes surface of a labelmap of blobs as from a segmentation, and an open
+// surface with boundaries and flat regions), written to the temporary
+// directory, and decimated by each method through the module entry point.
+// Throughput (input triangles per second of decimation time) and the
+// distance of the input to the output surface are read from the return
+// parameters of the module.
+//
+// Every result is checked without a baseline: the output must not be empty
+// and must have fewer triangles than the input, methods that reach the
+// target triangle count exactly must be close to it, and the Hausdorff
+// distance must be small compared to the size of the mesh.
+//
+// Results are written to a CSV file, which can be used as the baseline of
+// later runs: the benchmark fails if the throughput of a method drops, or its
+// Hausdorff distance grows, by more than the tolerance.
+//
+// Usage:
+//   DecimationBenchmark --size 1000000 --temp <directory>
+//     [--meshes Sphere,Blobs,Open]
+//     [--methods FastQuadric,FastQuadricHeap,ParallelQuadric,Quadric,DecimatePro,Lossless]
+//     [--reductionFactor 0.9] [--threads 0]
+//     [--output results.csv] [--baseline baseline.csv] [--tolerance 0.25]
+
+// VTK includes
+#include "vtkCellArray.h"
+#include "vtkFlyingEdges3D.h"
+#include "vtkImageData.h"
+#include "vtkNew.h"
+#include "vtkPoints.h"
+#include "vtkPolyData.h"
+#include "vtkSmartPointer.h"
+#include "vtkSphereSource.h"
+#include "vtkXMLPolyDataWriter.h"
+#include <vtksys/SystemTools.hxx>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+# define MODULE_IMPORT __declspec(dllimport)
+#else
+# define MODULE_IMPORT
+#endif
+
+extern "C" MODULE_IMPORT int ModuleEntryPoint(int, char* []);
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+struct BenchmarkOptions
+  {
+  long long Size = 100000;
+  std::vector<std::string> Meshes = { "Sphere", "Blobs", "Open" };
+  std::vector<std::string> Methods = { "FastQuadric", "FastQuadricHeap", "ParallelQuadric", "Quadric", "DecimatePro", "Lossless" };
+  double ReductionFactor = 0.9;
+  int Threads = 0;
+  std::string TempDirectory;
+  std::string OutputFile;
+  std::string BaselineFile;
+  double Tolerance = 0.25;
+  };
+
+//----------------------------------------------------------------------------
+// Result of decimating one mesh with one method (times in seconds)
+struct BenchmarkResult
+  {
+  std::string Mesh;
+  long long Size = 0;
+  std::string Method;
+  long long InputTriangles = 0;
+  long long OutputTriangles = 0;
+  double DecimationTime = 0.0;
+  double Throughput = 0.0;
+  double HausdorffDistance = -1.0;
+  double MeanDistance = -1.0;
+  };
+
+//----------------------------------------------------------------------------
+std::vector<std::string> SplitList(const std::string& text)
+{
+  std::vector<std::string> items;
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ','))
+    {
+    if (!item.empty())
+      {
+      items.push_back(item);
+      }
+    }
+  return items;
+}
+
+//----------------------------------------------------------------------------
+// UV sphere of about size triangles
+vtkSmartPointer<vtkPolyData> GenerateSphere(long long size)
+{
+  int resolution = std::max(8, (int)std::sqrt((double)size));
+  vtkNew<vtkSphereSource> sphere;
+  sphere->SetRadius(50.0);
+  sphere->SetThetaResolution(resolution);
+  sphere->SetPhiResolution(resolution / 2 + 1);
+  sphere->Update();
+  return sphere->GetOutput();
+}
+
+//----------------------------------------------------------------------------
+// Marching cubes surface of a labelmap of overlapping Gaussian blobs in a
+// 100 mm cube, sampled at resolution^3 voxels, as a segmentation without
+// smoothing (with many coplanar triangles). The blobs are the same in every
+// run.
+vtkSmartPointer<vtkPolyData> GenerateBlobs(int resolution)
+{
+  const int blobCount = 16;
+  std::mt19937 random(42);
+  auto uniform = [&random](double low, double high) { return low + (high - low) * (random() / 4294967296.0); };
+  double centers[blobCount][3];
+  double radii[blobCount];
+  for (int b = 0; b < blobCount; ++b)
+    {
+    for (int a = 0; a < 3; ++a)
+      {
+      centers[b][a] = uniform(25.0, 75.0);
+      }
+    radii[b] = uniform(6.0, 14.0);
+    }
+
+  vtkNew<vtkImageData> image;
+  image->SetDimensions(resolution, resolution, resolution);
+  double spacing = 100.0 / (resolution - 1);
+  image->SetSpacing(spacing, spacing, spacing);
+  image->AllocateScalars(VTK_FLOAT, 1);
+  float* values = static_cast<float*>(image->GetScalarPointer());
+  std::fill(values, values + (size_t)resolution * resolution * resolution, 0.0f);
+  // exp(-|x-c|^2/r^2) is separable, the factors are computed per axis
+  std::vector<double> factors[3];
+  for (int b = 0; b < blobCount; ++b)
+    {
+    for (int a = 0; a < 3; ++a)
+      {
+      factors[a].resize(resolution);
+      for (int i = 0; i < resolution; ++i)
+        {
+        double d = (i * spacing - centers[b][a]) / radii[b];
+        factors[a][i] = std::exp(-d * d);
+        }
+      }
+    for (int k = 0; k < resolution; ++k)
+      {
+      if (factors[2][k] < 1e-6)
+        {
+        continue;
+        }
+      for (int j = 0; j < resolution; ++j)
+        {
+        double fjk = factors[1][j] * factors[2][k];
+        if (fjk < 1e-6)
+          {
+          continue;
+          }
+        float* row = values + ((size_t)k * resolution + j) * resolution;
+        for (int i = 0; i < resolution; ++i)
+          {
+          row[i] += static_cast<float>(factors[0][i] * fjk);
+          }
+        }
+      }
+    }
+  for (size_t i = 0; i < (size_t)resolution * resolution * resolution; ++i)
+    {
+    values[i] = values[i] >= 0.5f ? 1.0f : 0.0f;
+    }
+
+  vtkNew<vtkFlyingEdges3D> contour;
+  contour->SetInputData(image);
+  contour->SetValue(0, 0.5);
+  contour->ComputeNormalsOff();
+  contour->ComputeGradientsOff();
+  contour->ComputeScalarsOff();
+  contour->Update();
+  return contour->GetOutput();
+}
+
+//----------------------------------------------------------------------------
+// Blobs of about size triangles: the triangle count grows with the square
+// of the resolution, which is estimated from a coarse trial surface
+vtkSmartPointer<vtkPolyData> GenerateBlobsOfSize(long long size)
+{
+  const int trialResolution = 48;
+  vtkSmartPointer<vtkPolyData> trial = GenerateBlobs(trialResolution);
+  double scale = std::sqrt((double)size / std::max<vtkIdType>(trial->GetNumberOfPolys(), 1));
+  return GenerateBlobs(std::max(8, (int)std::round(trialResolution * scale)));
+}
+
+//----------------------------------------------------------------------------
+// Height field of about size triangles with three circular holes, so it has
+// an outer and three inner boundaries. About half of it is flat.
+vtkSmartPointer<vtkPolyData> GenerateOpenSurface(long long size)
+{
+  int cells = std::max(4, (int)std::sqrt(size / 2.0));
+  double spacing = 100.0 / cells;
+  vtkNew<vtkPoints> points;
+  points->SetNumberOfPoints((vtkIdType)(cells + 1) * (cells + 1));
+  for (int j = 0; j <= cells; ++j)
+    {
+    for (int i = 0; i <= cells; ++i)
+      {
+      double x = i * spacing, y = j * spacing;
+      double z = std::max(0.0, 5.0 * std::sin(x * 0.1) * std::cos(y * 0.13) + 2.0 * std::sin(x * 0.05 + y * 0.07));
+      points->SetPoint((vtkIdType)j * (cells + 1) + i, x, y, z);
+      }
+    }
+  const double holes[3][3] = { { 30.0, 30.0, 10.0 }, { 70.0, 40.0, 8.0 }, { 45.0, 75.0, 12.0 } };
+  vtkNew<vtkCellArray> polys;
+  for (int j = 0; j < cells; ++j)
+    {
+    for (int i = 0; i < cells; ++i)
+      {
+      double x = (i + 0.5) * spacing, y = (j + 0.5) * spacing;
+      bool inHole = false;
+      for (const double* hole : holes)
+        {
+        inHole = inHole || (x - hole[0]) * (x - hole[0]) + (y - hole[1]) * (y - hole[1]) < hole[2] * hole[2];
+        }
+      if (inHole)
+        {
+        continue;
+        }
+      vtkIdType p00 = (vtkIdType)j * (cells + 1) + i;
+      vtkIdType p10 = p00 + 1, p01 = p00 + cells + 1, p11 = p01 + 1;
+      vtkIdType triangle0[3] = { p00, p10, p11 };
+      vtkIdType triangle1[3] = { p00, p11, p01 };
+      polys->InsertNextCell(3, triangle0);
+      polys->InsertNextCell(3, triangle1);
+      }
+    }
+  vtkSmartPointer<vtkPolyData> polyData = vtkSmartPointer<vtkPolyData>::New();
+  polyData->SetPoints(points);
+  polyData->SetPolys(polys);
+  return polyData;
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkPolyData> GenerateMesh(const std::string& mesh, long long size)
+{
+  if (mesh == "Sphere")
+    {
+    return GenerateSphere(size);
+    }
+  if (mesh == "Blobs")
+    {
+    return GenerateBlobsOfSize(size);
+    }
+  if (mesh == "Open")
+    {
+    return GenerateOpenSurface(size);
+    }
+  return nullptr;
+}
+
+//----------------------------------------------------------------------------
+// Decimate a model by calling the module, Lossless means FastQuadric method
+// with lossless decimation. The return parameters are stored in report.
+bool RunMethod(const BenchmarkOptions& options, const std::string& method, const std::string& inputModel,
+  const std::string& outputModel, std::map<std::string, std::string>& report)
+{
+  std::string returnParameterFile = options.TempDirectory + "/DecimationBenchmarkReturn.txt";
+  std::vector<std::string> args = { "Decimation",
+    "--reductionFactor", std::to_string(options.ReductionFactor),
+    "--threads", std::to_string(options.Threads),
+    "--measureError",
+    "--returnparameterfile", returnParameterFile };
+  if (method == "Lossless")
+    {
+    args.insert(args.end(), { "--method", "FastQuadric", "--lossless" });
+    }
+  else
+    {
+    args.insert(args.end(), { "--method", method });
+    }
+  args.push_back(inputModel);
+  args.push_back(outputModel);
+  std::vector<char*> argv;
+  for (std::string& arg : args)
+    {
+    argv.push_back(&arg[0]);
+    }
+
+  // the module reports progress on the standard output, it is only shown
+  // if decimation fails
+  std::ostringstream moduleOutput;
+  std::streambuf* coutBuffer = std::cout.rdbuf(moduleOutput.rdbuf());
+  int status = ModuleEntryPoint(static_cast<int>(argv.size()), argv.data());
+  std::cout.rdbuf(coutBuffer);
+  if (status != EXIT_SUCCESS)
+    {
+    std::cerr << moduleOutput.str();
+    return false;
+    }
+
+  std::ifstream file(returnParameterFile);
+  std::string line;
+  while (std::getline(file, line))
+    {
+    size_t separator = line.find(" = ");
+    if (separator != std::string::npos)
+      {
+      report[line.substr(0, separator)] = line.substr(separator + 3);
+      }
+    }
+  return !report.empty();
+}
+
+//----------------------------------------------------------------------------
+// Largest Hausdorff distance accepted by CheckResult, relative to the
+// bounding box diagonal of the mesh
+const double MaximumRelativeHausdorffDistance = 0.05;
+
+// Methods that stop exactly at the target triangle count, and the accepted
+// difference from it (a collapse removes up to two triangles)
+const std::vector<std::string> ExactTargetMethods = { "FastQuadricHeap", "ParallelQuadric" };
+const double TargetTolerance = 0.01;
+
+//----------------------------------------------------------------------------
+// Check a result without a baseline, meshSize is the bounding box diagonal
+// of the input mesh. Returns false (and prints the reason) if the method
+// did not decimate the mesh as requested.
+bool CheckResult(const BenchmarkOptions& options, const BenchmarkResult& result, double meshSize)
+{
+  std::string name = result.Mesh + " " + std::to_string(result.Size) + " " + result.Method;
+  bool valid = true;
+  if (result.OutputTriangles <= 0)
+    {
+    std::cerr << "Check failed: " << name << ": output mesh is empty" << std::endl;
+    valid = false;
+    }
+  else if (result.OutputTriangles >= result.InputTriangles)
+    {
+    std::cerr << "Check failed: " << name << ": output has " << result.OutputTriangles
+      << " triangles, input has " << result.InputTriangles << std::endl;
+    valid = false;
+    }
+  if (std::find(ExactTargetMethods.begin(), ExactTargetMethods.end(), result.Method) != ExactTargetMethods.end())
+    {
+    // same target as the module computes
+    double target = std::round(result.InputTriangles * (1.0 - options.ReductionFactor));
+    if (std::abs(result.OutputTriangles - target) > std::max(2.0, target * TargetTolerance))
+      {
+      std::cerr << "Check failed: " << name << ": output has " << result.OutputTriangles
+        << " triangles, target is " << target << std::endl;
+      valid = false;
+      }
+    }
+  if (result.HausdorffDistance < 0.0)
+    {
+    std::cerr << "Check failed: " << name << ": Hausdorff distance is not reported" << std::endl;
+    valid = false;
+    }
+  else if (!(result.HausdorffDistance <= meshSize * MaximumRelativeHausdorffDistance))
+    {
+    std::cerr << "Check failed: " << name << ": Hausdorff distance " << result.HausdorffDistance
+      << " exceeds " << MaximumRelativeHausdorffDistance << " of the mesh size " << meshSize << std::endl;
+    valid = false;
+    }
+  return valid;
+}
+
+//----------------------------------------------------------------------------
+const char* ResultsHeader = "mesh,size,method,inputTriangles,outputTriangles,decimationTime,throughput,hausdorffDistance,meanDistance";
+
+//----------------------------------------------------------------------------
+bool WriteResults(const std::string& fileName, const std::vector<BenchmarkResult>& results)
+{
+  std::ofstream file(fileName);
+  file << ResultsHeader << "\n";
+  for (const BenchmarkResult& result : results)
+    {
+    file << result.Mesh << "," << result.Size << "," << result.Method << ","
+      << result.InputTriangles << "," << result.OutputTriangles << "," << result.DecimationTime << ","
+      << result.Throughput << "," << result.HausdorffDistance << "," << result.MeanDistance << "\n";
+    }
+  file.close();
+  if (!file)
+    {
+    std::cerr << "Failed to write benchmark results: " << fileName << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Read results written by WriteResults, header lines are skipped
+bool ReadResults(const std::string& fileName, std::vector<BenchmarkResult>& results)
+{
+  std::ifstream file(fileName);
+  if (!file)
+    {
+    return false;
+    }
+  std::string line;
+  while (std::getline(file, line))
+    {
+    if (line.empty() || line.compare(0, 5, "mesh,") == 0)
+      {
+      continue;
+      }
+    std::vector<std::string> fields = SplitList(line);
+    if (fields.size() != 9)
+      {
+      std::cerr << "Invalid benchmark result: " << line << std::endl;
+      return false;
+      }
+    BenchmarkResult result;
+    result.Mesh = fields[0];
+    result.Size = std::atoll(fields[1].c_str());
+    result.Method = fields[2];
+    result.InputTriangles = std::atoll(fields[3].c_str());
+    result.OutputTriangles = std::atoll(fields[4].c_str());
+    result.DecimationTime = std::atof(fields[5].c_str());
+    result.Throughput = std::atof(fields[6].c_str());
+    result.HausdorffDistance = std::atof(fields[7].c_str());
+    result.MeanDistance = std::atof(fields[8].c_str());
+    results.push_back(result);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Compare the results with the baseline results of the same mesh, size, and
+// method, returns the number of regressions
+int CompareWithBaseline(const std::vector<BenchmarkResult>& results, const std::vector<BenchmarkResult>& baseline, double tolerance)
+{
+  int regressions = 0;
+  for (const BenchmarkResult& result : results)
+    {
+    auto expected = std::find_if(baseline.begin(), baseline.end(), [&result](const BenchmarkResult& b)
+      { return b.Mesh == result.Mesh && b.Size == result.Size && b.Method == result.Method; });
+    if (expected == baseline.end())
+      {
+      continue;
+      }
+    std::string name = result.Mesh + " " + std::to_string(result.Size) + " " + result.Method;
+    if (expected->Throughput > 0 && result.Throughput < expected->Throughput * (1.0 - tolerance))
+      {
+      std::cerr << "Performance regression: " << name << ": " << result.Throughput
+        << " triangles/s, baseline " << expected->Throughput << " triangles/s" << std::endl;
+      regressions++;
+      }
+    if (expected->HausdorffDistance >= 0 && result.HausdorffDistance > expected->HausdorffDistance * (1.0 + tolerance) + 1e-9)
+      {
+      std::cerr << "Accuracy regression: " << name << ": Hausdorff distance " << result.HausdorffDistance
+        << ", baseline " << expected->HausdorffDistance << std::endl;
+      regressions++;
+      }
+    }
+  return regressions;
+}
+
+//----------------------------------------------------------------------------
+void PrintUsage()
+{
+  std::cerr << "Usage: DecimationBenchmark --size <triangles> --temp <directory>"
+    << " [--meshes Sphere,Blobs,Open]"
+    << " [--methods FastQuadric,FastQuadricHeap,ParallelQuadric,Quadric,DecimatePro,Lossless]"
+    << " [--reductionFactor 0.9] [--threads 0]"
+    << " [--output results.csv] [--baseline baseline.csv] [--tolerance 0.25]" << std::endl;
+}
+
+//----------------------------------------------------------------------------
+bool ParseArguments(int argc, char* argv[], BenchmarkOptions& options)
+{
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+      {
+      return false;
+      }
+    std::string value = argv[++i];
+    if (arg == "--size")
+      {
+      options.Size = std::atoll(value.c_str());
+      }
+    else if (arg == "--meshes")
+      {
+      options.Meshes = SplitList(value);
+      }
+    else if (arg == "--methods")
+      {
+      options.Methods = SplitList(value);
+      }
+    else if (arg == "--reductionFactor")
+      {
+      options.ReductionFactor = std::atof(value.c_str());
+      }
+    else if (arg == "--threads")
+      {
+      options.Threads = std::atoi(value.c_str());
+      }
+    else if (arg == "--temp")
+      {
+      options.TempDirectory = value;
+      }
+    else if (arg == "--output")
+      {
+      options.OutputFile = value;
+      }
+    else if (arg == "--baseline")
+      {
+      options.BaselineFile = value;
+      }
+    else if (arg == "--tolerance")
+      {
+      options.Tolerance = std::atof(value.c_str());
+      }
+    else
+      {
+      return false;
+      }
+    }
+  return options.Size > 0 && !options.TempDirectory.empty();
+}
+
+} // end of anonymous namespace
+
+int main(int argc, char* argv[])
+{
+  BenchmarkOptions options;
+  if (!ParseArguments(argc, argv, options))
+    {
+    PrintUsage();
+    return EXIT_FAILURE;
+    }
+  vtksys::SystemTools::MakeDirectory(options.TempDirectory);
+
+  std::vector<BenchmarkResult> results;
+  bool failed = false;
+  std::cout << std::left << std::setw(8) << "Mesh" << std::setw(18) << "Method" << std::right
+    << std::setw(12) << "Input" << std::setw(12) << "Output" << std::setw(12) << "Time (s)"
+    << std::setw(14) << "Triangles/s" << std::setw(14) << "Hausdorff" << std::setw(14) << "Mean dist." << std::endl;
+  for (const std::string& mesh : options.Meshes)
+    {
+    vtkSmartPointer<vtkPolyData> polyData = GenerateMesh(mesh, options.Size);
+    if (!polyData)
+      {
+      std::cerr << "Unknown benchmark mesh: " << mesh << std::endl;
+      failed = true;
+      continue;
+      }
+    double meshSize = polyData->GetLength();
+    std::string inputModel = options.TempDirectory + "/DecimationBenchmark_" + mesh + "_" + std::to_string(options.Size) + ".vtp";
+    vtkNew<vtkXMLPolyDataWriter> writer;
+    writer->SetInputData(polyData);
+    writer->SetFileName(inputModel.c_str());
+    writer->SetDataModeToBinary();
+    writer->SetCompressorTypeToNone();
+    if (!writer->Write())
+      {
+      std::cerr << "Failed to write benchmark mesh: " << inputModel << std::endl;
+      return EXIT_FAILURE;
+      }
+    polyData = nullptr;
+
+    for (const std::string& method : options.Methods)
+      {
+      if (method == "Lossless" && mesh == "Sphere")
+        {
+        // no coplanar triangles, lossless decimation cannot remove any
+        continue;
+        }
+      std::string outputModel = options.TempDirectory + "/DecimationBenchmark_" + mesh + "_" + method + ".vtp";
+      std::map<std::string, std::string> report;
+      if (!RunMethod(options, method, inputModel, outputModel, report))
+        {
+        std::cerr << "Decimation failed: " << mesh << " " << method << std::endl;
+        failed = true;
+        continue;
+        }
+      BenchmarkResult result;
+      result.Mesh = mesh;
+      result.Size = options.Size;
+      result.Method = method;
+      result.InputTriangles = std::atoll(report["inputTriangles"].c_str());
+      result.OutputTriangles = std::atoll(report["outputTriangles"].c_str());
+      result.DecimationTime = std::atof(report["decimationTime"].c_str());
+      result.Throughput = result.DecimationTime > 0 ? result.InputTriangles / result.DecimationTime : 0.0;
+      result.HausdorffDistance = std::atof(report["hausdorffDistance"].c_str());
+      result.MeanDistance = std::atof(report["meanDistance"].c_str());
+      results.push_back(result);
+      std::cout << std::left << std::setw(8) << mesh << std::setw(18) << method << std::right
+        << std::setw(12) << result.InputTriangles << std::setw(12) << result.OutputTriangles
+        << std::setw(12) << result.DecimationTime << std::setw(14) << (long long)result.Throughput
+        << std::setw(14) << result.HausdorffDistance << std::setw(14) << result.MeanDistance << std::endl;
+      if (!CheckResult(options, result, meshSize))
+        {
+        failed = true;
+        }
+      vtksys::SystemTools::RemoveFile(outputModel);
+      }
+    vtksys::SystemTools::RemoveFile(inputModel);
+    }
+
+  if (!options.OutputFile.empty() && !WriteResults(options.OutputFile, results))
+    {
+    failed = true;
+    }
+  if (!options.BaselineFile.empty())
+    {
+    std::vector<BenchmarkResult> baseline;
+    if (!ReadResults(options.BaselineFile, baseline))
+      {
+      std::cout << "Baseline could not be read, results are not compared: " << options.BaselineFile << std::endl;
+      }
+    else if (CompareWithBaseline(results, baseline, options.Tolerance) > 0)
+      {
+      failed = true;
+      }
+    }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/*==============================================================================
+
+  Copyright (c) Laboratory for Percutaneous Surgery (PerkLab)
+  Queen's University, Kingston, ON, Canada. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkFastQuadricDecimation.h"
+
+// VTK includes
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include <vtkTriangleFilter.h>
+
+// Decimation includes
+#include "FastQuadricPolyData.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+vtkStandardNewMacro(vtkFastQuadricDecimation);
+
+//-----------------------------------------------------------------------------
+vtkFastQuadricDecimation::vtkFastQuadricDecimation() = default;
+
+//-----------------------------------------------------------------------------
+vtkFastQuadricDecimation::~vtkFastQuadricDecimation() = default;
+
+//-----------------------------------------------------------------------------
+void vtkFastQuadricDecimation::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "TargetReduction: " << this->TargetReduction << "\n";
+  os << indent << "Aggressiveness: " << this->Aggressiveness << "\n";
+  os << indent << "UsePriorityQueue: " << (this->UsePriorityQueue ? "On" : "Off") << "\n";
+  os << indent << "Lossless: " << (this->Lossless ? "On" : "Off") << "\n";
+  os << indent << "VolumePreservation: " << (this->VolumePreservation ? "On" : "Off") << "\n";
+  os << indent << "MaximumError: " << this->MaximumError << "\n";
+  os << indent << "AchievedError: " << this->AchievedError << "\n";
+  os << indent << "BoundaryVertexDeletion: " << (this->BoundaryVertexDeletion ? "On" : "Off") << "\n";
+  os << indent << "BoundaryWeight: " << this->BoundaryWeight << "\n";
+  os << indent << "FeatureAngle: " << this->FeatureAngle << "\n";
+  os << indent << "FeatureWeight: " << this->FeatureWeight << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "Deterministic: " << (this->Deterministic ? "On" : "Off") << "\n";
+}
+
+//-----------------------------------------------------------------------------
+int vtkFastQuadricDecimation::RequestData(vtkInformation* vtkNotUsed(request),
+  vtkInformationVector** inputVector, vtkInformationVector* outputVector)
+{
+  vtkPolyData* input = vtkPolyData::GetData(inputVector[0]);
+  vtkPolyData* output = vtkPolyData::GetData(outputVector);
+  if (!input || !output)
+    {
+    return 0;
+    }
+  this->AchievedError = 0.0;
+  if (!input->GetPoints() || input->GetNumberOfPolys() + input->GetNumberOfStrips() == 0)
+    {
+    vtkDebugMacro("No triangles to decimate");
+    return 1;
+    }
+
+  // Triangle meshes (such as marching cubes output) are used directly
+  vtkSmartPointer<vtkPolyData> triangles = input;
+  if (!FastQuadricIsTriangleMesh(input))
+    {
+    vtkNew<vtkTriangleFilter> triangulate;
+    triangulate->SetInputData(input);
+    triangulate->PassVertsOff();
+    triangulate->PassLinesOff();
+    triangulate->Update();
+    triangles = triangulate->GetOutput();
+    }
+
+  FastQuadricSimplifier simplifier;
+  simplifier.threads = this->NumberOfThreads;
+  simplifier.deterministic = this->Deterministic;
+  simplifier.max_error = this->MaximumError;
+  simplifier.volume_preservation = this->VolumePreservation;
+  simplifier.lock_border = !this->BoundaryVertexDeletion;
+  simplifier.border_weight = this->BoundaryWeight;
+  simplifier.feature_angle = this->FeatureAngle;
+  simplifier.feature_weight = this->FeatureWeight;
+  simplifier.progress_callback = [this](const FastQuadricSimplifier::Progress& progress)
+    {
+    this->UpdateProgress(std::max(progress.fraction, 0.0));
+    return !this->GetAbortExecute();
+    };
+  FastQuadricImportPolyData(triangles, simplifier);
+
+  int targetCount = static_cast<int>(std::round(simplifier.triangles.size() * (1.0 - this->TargetReduction)));
+  if (targetCount < 4 && this->MaximumError > 0.0)
+    {
+    // the error bound stops the decimation
+    targetCount = 4;
+    }
+  if (simplifier.triangles.size() < 3 || simplifier.vertices.size() < 3 || targetCount < 4)
+    {
+    vtkWarningMacro("Mesh is too small for the requested reduction, it is not decimated");
+    output->ShallowCopy(triangles);
+    return 1;
+    }
+
+  if (this->Lossless)
+    {
+    simplifier.simplify_mesh_lossless();
+    }
+  else if (this->UsePriorityQueue)
+    {
+    simplifier.simplify_mesh_heap(targetCount);
+    }
+  else
+    {
+    simplifier.simplify_mesh(targetCount, this->Aggressiveness);
+    }
+
+  this->AchievedError = simplifier.collapse_error;
+  output->ShallowCopy(FastQuadricExportPolyData(simplifier, triangles));
+  return 1;
+}
@@ -0,0 +1,135 @@
+/*==============================================================================
+
+  Copyright (c) Laboratory for Percutaneous Surgery (PerkLab)
+  Queen's University, Kingston, ON, Canada. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef vtkFastQuadricDecimation_h
+#define vtkFastQuadricDecimation_h
+
+#include "vtkSlicerDynamicModelerModuleLogicExport.h"
+
+// VTK includes
+#include <vtkPolyDataAlgorithm.h>
+
+/// \brief Reduce the number of triangles of a surface mesh.
+///
+/// Runs the FastQuadric method of the Decimation module (Sven Forstmann's
+/// fast quadric mesh simplification) directly on a vtkPolyData, without
+/// writing the mesh to files and starting a CLI.
+/// Polygons and strips are triangulated. Point data arrays of floating point
+/// type are interpolated along the collapsed edges. Integer arrays (labels,
+/// segment IDs) are not interpolated: the remaining vertex keeps its value,
+/// which is exact up to 2^24. Cell data is not passed to the output.
+/// Progress is reported during decimation. If execution is aborted, the
+/// partially decimated mesh is returned.
+class VTK_SLICER_DYNAMICMODELER_MODULE_LOGIC_EXPORT vtkFastQuadricDecimation : public vtkPolyDataAlgorithm
+{
+public:
+  static vtkFastQuadricDecimation* New();
+  vtkTypeMacro(vtkFastQuadricDecimation, vtkPolyDataAlgorithm);
+  void PrintSelf(ostream& os, vtkIndent indent) override;
+
+  /// Ratio of triangles that are requested to be eliminated.
+  /// 0.8 means that the mesh size is requested to be reduced by 80%.
+  vtkSetClampMacro(TargetReduction, double, 0.0, 1.0);
+  vtkGetMacro(TargetReduction, double);
+
+  /// Balances between accuracy and computation time (default = 7.0).
+  vtkSetMacro(Aggressiveness, double);
+  vtkGetMacro(Aggressiveness, double);
+
+  /// Collapse edges strictly in the order of increasing error using a
+  /// priority queue (FastQuadricHeap method). Slower but more accurate.
+  /// Runs on a single thread, so the result does not depend on the number
+  /// of cores.
+  vtkSetMacro(UsePriorityQueue, bool);
+  vtkGetMacro(UsePriorityQueue, bool);
+  vtkBooleanMacro(UsePriorityQueue, bool);
+
+  /// Only remove triangles that do not change the shape of the surface.
+  /// TargetReduction is ignored in this mode.
+  vtkSetMacro(Lossless, bool);
+  vtkGetMacro(Lossless, bool);
+  vtkBooleanMacro(Lossless, bool);
+
+  /// Place the vertex of each edge collapse so that the volume enclosed by
+  /// the surface does not change (as in vtkQuadricDecimation).
+  vtkSetMacro(VolumePreservation, bool);
+  vtkGetMacro(VolumePreservation, bool);
+  vtkBooleanMacro(VolumePreservation, bool);
+
+  /// If positive, decimation stops when removing more triangles would move
+  /// the surface farther than this distance, even if TargetReduction is not
+  /// reached yet. 0 (default) means no error bound.
+  vtkSetClampMacro(MaximumError, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(MaximumError, double);
+
+  /// Largest error (distance) of the edge collapses in the last update.
+  vtkGetMacro(AchievedError, double);
+
+  /// Allow moving and removing boundary vertices (default).
+  /// If disabled then the boundary of open surfaces is kept unchanged.
+  vtkSetMacro(BoundaryVertexDeletion, bool);
+  vtkGetMacro(BoundaryVertexDeletion, bool);
+  vtkBooleanMacro(BoundaryVertexDeletion, bool);
+
+  /// Weight of the error of moving boundary vertices away from the
+  /// boundary. 0 (default) means that the boundary is not constrained.
+  vtkSetClampMacro(BoundaryWeight, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(BoundaryWeight, double);
+
+  /// Edges where the angle between the triangle normals is larger than
+  /// this (in degrees) are feature edges. 0 (default) means no feature edges.
+  vtkSetClampMacro(FeatureAngle, double, 0.0, 180.0);
+  vtkGetMacro(FeatureAngle, double);
+
+  /// Weight of the error of moving vertices away from feature edges (default = 1000).
+  vtkSetClampMacro(FeatureWeight, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(FeatureWeight, double);
+
+  /// Number of threads. 0 means all available cores (default).
+  vtkSetMacro(NumberOfThreads, int);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// If enabled (default) then the result does not depend on the number of threads.
+  vtkSetMacro(Deterministic, bool);
+  vtkGetMacro(Deterministic, bool);
+  vtkBooleanMacro(Deterministic, bool);
+
+protected:
+  vtkFastQuadricDecimation();
+  ~vtkFastQuadricDecimation() override;
+
+  int RequestData(vtkInformation* request, vtkInformationVector** inputVector, vtkInformationVector* outputVector) override;
+
+  double TargetReduction{ 0.8 };
+  double Aggressiveness{ 7.0 };
+  bool UsePriorityQueue{ false };
+  bool Lossless{ false };
+  bool VolumePreservation{ false };
+  double MaximumError{ 0.0 };
+  double AchievedError{ 0.0 };
+  bool BoundaryVertexDeletion{ true };
+  double BoundaryWeight{ 0.0 };
+  double FeatureAngle{ 0.0 };
+  double FeatureWeight{ 1000.0 };
+  int NumberOfThreads{ 0 };
+  bool Deterministic{ true };
+
+private:
+  vtkFastQuadricDecimation(const vtkFastQuadricDecimation&) = delete;
+  void operator=(const vtkFastQuadricDecimation&) = delete;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*==============================================================================
+
+  Copyright (c) Laboratory for Percutaneous Surgery (PerkLab)
+  Queen's University, Kingston, ON, Canada. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkFastQuadricProgressiveMeshReader.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkTypeInt32Array.h>
+
+// Decimation includes
+#include "FastQuadricProgressive.h"
+
+// STD includes
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+class vtkFastQuadricProgressiveMeshReader::vtkInternal
+{
+public:
+  FastQuadricProgressiveMesh Mesh;
+  std::string LoadedFileName;
+};
+
+vtkStandardNewMacro(vtkFastQuadricProgressiveMeshReader);
+
+//-----------------------------------------------------------------------------
+vtkFastQuadricProgressiveMeshReader::vtkFastQuadricProgressiveMeshReader()
+{
+  this->SetNumberOfInputPorts(0);
+  this->Internal = new vtkInternal;
+}
+
+//-----------------------------------------------------------------------------
+vtkFastQuadricProgressiveMeshReader::~vtkFastQuadricProgressiveMeshReader()
+{
+  this->SetFileName(nullptr);
+  delete this->Internal;
+}
+
+//-----------------------------------------------------------------------------
+void vtkFastQuadricProgressiveMeshReader::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "FileName: " << (this->FileName ? this->FileName : "(none)") << "\n";
+  os << indent << "TargetNumberOfTriangles: " << this->TargetNumberOfTriangles << "\n";
+  os << indent << "NumberOfBaseTriangles: " << this->GetNumberOfBaseTriangles() << "\n";
+  os << indent << "NumberOfOriginalTriangles: " << this->GetNumberOfOriginalTriangles() << "\n";
+}
+
+//-----------------------------------------------------------------------------
+vtkIdType vtkFastQuadricProgressiveMeshReader::GetNumberOfBaseTriangles()
+{
+  return this->Internal->Mesh.base_triangle_count;
+}
+
+//-----------------------------------------------------------------------------
+vtkIdType vtkFastQuadricProgressiveMeshReader::GetNumberOfOriginalTriangles()
+{
+  return this->Internal->Mesh.triangle_count();
+}
+
+//-----------------------------------------------------------------------------
+int vtkFastQuadricProgressiveMeshReader::RequestData(vtkInformation* vtkNotUsed(request),
+  vtkInformationVector** vtkNotUsed(inputVector), vtkInformationVector* outputVector)
+{
+  vtkPolyData* output = vtkPolyData::GetData(outputVector);
+  if (!output)
+    {
+    return 0;
+    }
+  if (!this->FileName)
+    {
+    vtkErrorMacro("RequestData: file name is not set");
+    return 0;
+    }
+
+  FastQuadricProgressiveMesh& mesh = this->Internal->Mesh;
+  if (this->Internal->LoadedFileName != this->FileName)
+    {
+    this->Internal->LoadedFileName.clear();
+    if (!mesh.read(this->FileName))
+      {
+      vtkErrorMacro("RequestData: failed to read progressive mesh file " << this->FileName);
+      return 0;
+      }
+    this->Internal->LoadedFileName = this->FileName;
+    }
+
+  // Only the splits between the current and the requested level are applied
+  if (this->TargetNumberOfTriangles < 0)
+    {
+    mesh.set_vertex_count(mesh.vertex_count());
+    }
+  else
+    {
+    mesh.set_triangle_count(static_cast<int>(std::min<vtkIdType>(this->TargetNumberOfTriangles, VTK_INT_MAX)));
+    }
+  vtkIdType numberOfPoints = mesh.current_vertex_count;
+  vtkIdType numberOfTriangles = mesh.triangle_count(mesh.current_vertex_count);
+
+  // The buffers of the mesh only have a prefix in use and are changed by the
+  // next update, so the output gets its own copy of the current level
+  vtkNew<vtkFloatArray> pointArray;
+  pointArray->SetNumberOfComponents(3);
+  pointArray->SetNumberOfTuples(numberOfPoints);
+  std::copy(mesh.current_points.begin(), mesh.current_points.begin() + 3 * numberOfPoints, pointArray->GetPointer(0));
+  vtkNew<vtkPoints> points;
+  points->SetData(pointArray);
+
+  vtkNew<vtkTypeInt32Array> offsets;
+  offsets->SetNumberOfValues(numberOfTriangles + 1);
+  for (vtkIdType i = 0; i <= numberOfTriangles; ++i)
+    {
+    offsets->SetValue(i, static_cast<vtkTypeInt32>(3 * i));
+    }
+  vtkNew<vtkTypeInt32Array> connectivity;
+  connectivity->SetNumberOfValues(3 * numberOfTriangles);
+  std::copy(mesh.current_triangles.begin(), mesh.current_triangles.begin() + 3 * numberOfTriangles, connectivity->GetPointer(0));
+  vtkNew<vtkCellArray> polys;
+  polys->SetData(offsets, connectivity);
+
+  output->SetPoints(points);
+  output->SetPolys(polys);
+  return 1;
+}
@@ -0,0 +1,81 @@
+/*==============================================================================
+
+  Copyright (c) Laboratory for Percutaneous Surgery (PerkLab)
+  Queen's University, Kingston, ON, Canada. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef vtkFastQuadricProgressiveMeshReader_h
+#define vtkFastQuadricProgressiveMeshReader_h
+
+#include "vtkSlicerDynamicModelerModuleLogicExport.h"
+
+// VTK includes
+#include <vtkPolyDataAlgorithm.h>
+
+// STD includes
+#include <string>
+
+/// \brief Read a progressive mesh file written by the Decimation module.
+///
+/// The file (.fqpm) stores a decimated base mesh and the vertex splits that
+/// restore the original mesh. The output is the finest level of detail with
+/// at most TargetNumberOfTriangles triangles. The file is only read once,
+/// changing the target refines or coarsens the previous output by applying
+/// or reverting the splits in between, so the cost of the refinement is
+/// proportional to the change, not to the mesh size. The points and
+/// triangles of the new level are then copied to the output, which owns
+/// its arrays and remains valid after the reader is deleted or updated.
+/// Only points and triangles are stored in the file, no point or cell data.
+class VTK_SLICER_DYNAMICMODELER_MODULE_LOGIC_EXPORT vtkFastQuadricProgressiveMeshReader : public vtkPolyDataAlgorithm
+{
+public:
+  static vtkFastQuadricProgressiveMeshReader* New();
+  vtkTypeMacro(vtkFastQuadricProgressiveMeshReader, vtkPolyDataAlgorithm);
+  void PrintSelf(ostream& os, vtkIndent indent) override;
+
+  /// Name of the progressive mesh file.
+  vtkSetStringMacro(FileName);
+  vtkGetStringMacro(FileName);
+
+  /// Maximum number of triangles of the output.
+  /// The base mesh is returned if it has more triangles than this.
+  /// Negative value (default) means the original, full resolution mesh.
+  vtkSetMacro(TargetNumberOfTriangles, vtkIdType);
+  vtkGetMacro(TargetNumberOfTriangles, vtkIdType);
+
+  /// Number of triangles of the base (coarsest) mesh in the file.
+  /// Available after the reader is updated.
+  vtkIdType GetNumberOfBaseTriangles();
+
+  /// Number of triangles of the original (finest) mesh in the file.
+  /// Available after the reader is updated.
+  vtkIdType GetNumberOfOriginalTriangles();
+
+protected:
+  vtkFastQuadricProgressiveMeshReader();
+  ~vtkFastQuadricProgressiveMeshReader() override;
+
+  int RequestData(vtkInformation* request, vtkInformationVector** inputVector, vtkInformationVector* outputVector) override;
+
+  char* FileName{ nullptr };
+  vtkIdType TargetNumberOfTriangles{ -1 };
+
+  class vtkInternal;
+  vtkInternal* Internal;
+
+private:
+  vtkFastQuadricProgressiveMeshReader(const vtkFastQuadricProgressiveMeshReader&) = delete;
+  void operator=(const vtkFastQuadricProgressiveMeshReader&) = delete;
+};
+
+#endif
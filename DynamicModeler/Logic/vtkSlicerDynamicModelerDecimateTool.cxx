@@ -0,0 +1,226 @@
+/*==============================================================================
+
+  Copyright (c) Laboratory for Percutaneous Surgery (PerkLab)
+  Queen's University, Kingston, ON, Canada. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkSlicerDynamicModelerDecimateTool.h"
+
+#include "vtkMRMLDynamicModelerNode.h"
+#include "vtkFastQuadricDecimation.h"
+
+// MRML includes
+#include <vtkMRMLModelNode.h>
+#include <vtkMRMLTransformNode.h>
+
+// VTK includes
+#include <vtkCommand.h>
+#include <vtkDoubleArray.h>
+#include <vtkGeneralTransform.h>
+#include <vtkIntArray.h>
+#include <vtkSmartPointer.h>
+#include <vtkStringArray.h>
+#include <vtkTransform.h>
+#include <vtkTransformPolyDataFilter.h>
+
+//----------------------------------------------------------------------------
+vtkToolNewMacro(vtkSlicerDynamicModelerDecimateTool);
+
+const char* DECIMATE_INPUT_MODEL_REFERENCE_ROLE = "Decimate.InputModel";
+const char* DECIMATE_OUTPUT_MODEL_REFERENCE_ROLE = "Decimate.OutputModel";
+
+//----------------------------------------------------------------------------
+vtkSlicerDynamicModelerDecimateTool::vtkSlicerDynamicModelerDecimateTool()
+{
+  /////////
+  // Inputs
+  vtkNew<vtkIntArray> inputModelEvents;
+  inputModelEvents->InsertNextTuple1(vtkCommand::ModifiedEvent);
+  inputModelEvents->InsertNextTuple1(vtkMRMLModelNode::MeshModifiedEvent);
+  inputModelEvents->InsertNextTuple1(vtkMRMLTransformableNode::TransformModifiedEvent);
+  vtkNew<vtkStringArray> inputModelClassNames;
+  inputModelClassNames->InsertNextValue("vtkMRMLModelNode");
+  NodeInfo inputModel(
+    "Model node",
+    "Model node to decimate.",
+    inputModelClassNames,
+    DECIMATE_INPUT_MODEL_REFERENCE_ROLE,
+    true,
+    false,
+    inputModelEvents
+  );
+  this->InputNodeInfo.push_back(inputModel);
+
+  /////////
+  // Outputs
+  NodeInfo outputModel(
+    "Output model (decimated)",
+    "Result of the decimation.",
+    inputModelClassNames,
+    DECIMATE_OUTPUT_MODEL_REFERENCE_ROLE,
+    false,
+    false
+  );
+  this->OutputNodeInfo.push_back(outputModel);
+
+  /////////
+  // Parameters
+  ParameterInfo parameterTargetReduction(
+    "Target reduction",
+    "Ratio of triangles that are requested to be eliminated. 0.8 means that the mesh size is requested to be reduced by 80%.",
+    "TargetReduction",
+    PARAMETER_DOUBLE,
+    0.8,
+    2,
+    0.01
+  );
+
+  vtkNew<vtkDoubleArray> targetReductionRange;
+  targetReductionRange->SetNumberOfComponents(1);
+  targetReductionRange->SetNumberOfValues(2);
+  targetReductionRange->SetValue(0, 0.0);
+  targetReductionRange->SetValue(1, 1.0);
+  parameterTargetReduction.NumbersRange = targetReductionRange;
+  this->InputParameterInfo.push_back(parameterTargetReduction);
+
+  ParameterInfo parameterMethod(
+    "Method",
+    "FastQuadric is the fastest. FastQuadricHeap collapses edges strictly in the order of increasing error,"
+    " which is usually more accurate and stops exactly at the target, but is slower.",
+    "Method",
+    PARAMETER_STRING_ENUM,
+    "FastQuadric"
+  );
+
+  vtkNew<vtkStringArray> possibleValues;
+  parameterMethod.PossibleValues = possibleValues;
+  parameterMethod.PossibleValues->InsertNextValue("FastQuadric");
+  parameterMethod.PossibleValues->InsertNextValue("FastQuadricHeap");
+  this->InputParameterInfo.push_back(parameterMethod);
+
+  ParameterInfo parameterPreserveBoundary(
+    "Preserve boundary",
+    "If enabled then boundary vertices of open surfaces are not moved or removed.",
+    "PreserveBoundary",
+    PARAMETER_BOOL,
+    false
+  );
+  this->InputParameterInfo.push_back(parameterPreserveBoundary);
+
+  ParameterInfo parameterFeatureAngle(
+    "Feature angle",
+    "Edges where the angle between the triangle normals is larger than this value (in degrees) are kept sharp. 0 means no feature edges.",
+    "FeatureAngle",
+    PARAMETER_DOUBLE,
+    0.0,
+    1,
+    1.0
+  );
+
+  vtkNew<vtkDoubleArray> featureAngleRange;
+  featureAngleRange->SetNumberOfComponents(1);
+  featureAngleRange->SetNumberOfValues(2);
+  featureAngleRange->SetValue(0, 0.0);
+  featureAngleRange->SetValue(1, 180.0);
+  parameterFeatureAngle.NumbersRange = featureAngleRange;
+  this->InputParameterInfo.push_back(parameterFeatureAngle);
+
+  this->InputModelToWorldTransformFilter = vtkSmartPointer<vtkTransformPolyDataFilter>::New();
+  this->InputModelNodeToWorldTransform = vtkSmartPointer<vtkGeneralTransform>::New();
+  this->InputModelToWorldTransformFilter->SetTransform(this->InputModelNodeToWorldTransform);
+
+  this->DecimationFilter = vtkSmartPointer<vtkFastQuadricDecimation>::New();
+  this->DecimationFilter->SetInputConnection(this->InputModelToWorldTransformFilter->GetOutputPort());
+
+  this->OutputModelToWorldTransformFilter = vtkSmartPointer<vtkTransformPolyDataFilter>::New();
+  this->OutputWorldToModelTransform = vtkSmartPointer<vtkGeneralTransform>::New();
+  this->OutputModelToWorldTransformFilter->SetTransform(this->OutputWorldToModelTransform);
+  this->OutputModelToWorldTransformFilter->SetInputConnection(this->DecimationFilter->GetOutputPort());
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerDynamicModelerDecimateTool::~vtkSlicerDynamicModelerDecimateTool()
+= default;
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerDynamicModelerDecimateTool::GetName()
+{
+  return "Decimate";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerDynamicModelerDecimateTool::RunInternal(vtkMRMLDynamicModelerNode* surfaceEditorNode)
+{
+  if (!this->HasRequiredInputs(surfaceEditorNode))
+    {
+    vtkErrorMacro("Invalid number of inputs");
+    return false;
+    }
+
+  vtkMRMLModelNode* outputModelNode = vtkMRMLModelNode::SafeDownCast(surfaceEditorNode->GetNodeReference(DECIMATE_OUTPUT_MODEL_REFERENCE_ROLE));
+  if (!outputModelNode)
+    {
+    // Nothing to output.
+    return true;
+    }
+
+  vtkMRMLModelNode* inputModelNode = vtkMRMLModelNode::SafeDownCast(surfaceEditorNode->GetNodeReference(DECIMATE_INPUT_MODEL_REFERENCE_ROLE));
+  if (!inputModelNode)
+    {
+    vtkErrorMacro("Invalid input model node!");
+    return false;
+    }
+
+  if (!inputModelNode->GetMesh() || inputModelNode->GetMesh()->GetNumberOfPoints() == 0)
+    {
+    return true;
+    }
+
+  double targetReduction = this->GetNthInputParameterValue(0, surfaceEditorNode).ToDouble();
+  std::string method = this->GetNthInputParameterValue(1, surfaceEditorNode).ToString();
+  bool preserveBoundary = this->GetNthInputParameterValue(2, surfaceEditorNode).ToInt() != 0;
+  double featureAngle = this->GetNthInputParameterValue(3, surfaceEditorNode).ToDouble();
+  this->DecimationFilter->SetTargetReduction(targetReduction);
+  this->DecimationFilter->SetUsePriorityQueue(method == "FastQuadricHeap");
+  this->DecimationFilter->SetBoundaryVertexDeletion(!preserveBoundary);
+  this->DecimationFilter->SetFeatureAngle(featureAngle);
+
+  if (inputModelNode->GetParentTransformNode())
+    {
+    inputModelNode->GetParentTransformNode()->GetTransformToWorld(this->InputModelNodeToWorldTransform);
+    }
+  else
+    {
+    this->InputModelNodeToWorldTransform->Identity();
+    }
+  if (outputModelNode && outputModelNode->GetParentTransformNode())
+    {
+    outputModelNode->GetParentTransformNode()->GetTransformFromWorld(this->OutputWorldToModelTransform);
+    }
+  else
+    {
+    this->OutputWorldToModelTransform->Identity();
+    }
+
+  this->InputModelToWorldTransformFilter->SetInputConnection(inputModelNode->GetMeshConnection());
+
+  this->OutputModelToWorldTransformFilter->Update();
+  vtkNew<vtkPolyData> outputMesh;
+  outputMesh->DeepCopy(this->OutputModelToWorldTransformFilter->GetOutput());
+
+  MRMLNodeModifyBlocker blocker(outputModelNode);
+  outputModelNode->SetAndObserveMesh(outputMesh);
+  outputModelNode->InvokeCustomModifiedEvent(vtkMRMLModelNode::MeshModifiedEvent);
+
+  return true;
+}
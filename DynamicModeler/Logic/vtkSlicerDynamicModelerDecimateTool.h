@@ -0,0 +1,75 @@
+/*==============================================================================
+
+  Copyright (c) Laboratory for Percutaneous Surgery (PerkLab)
+  Queen's University, Kingston, ON, Canada. All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef __vtkSlicerDynamicModelerDecimateTool_h
+#define __vtkSlicerDynamicModelerDecimateTool_h
+
+#include "vtkSlicerDynamicModelerModuleLogicExport.h"
+
+// VTK includes
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+
+// STD includes
+#include <map>
+#include <string>
+#include <vector>
+
+class vtkDataObject;
+class vtkFastQuadricDecimation;
+class vtkGeneralTransform;
+class vtkMRMLDynamicModelerNode;
+class vtkPolyData;
+class vtkTransformPolyDataFilter;
+
+#include "vtkSlicerDynamicModelerTool.h"
+
+/// \brief Dynamic modeler tool to reduce the number of triangles of a mesh.
+///
+/// Has one node input (Surface), and one output (The decimated surface).
+/// The mesh is decimated in-process using vtkFastQuadricDecimation.
+class VTK_SLICER_DYNAMICMODELER_MODULE_LOGIC_EXPORT vtkSlicerDynamicModelerDecimateTool : public vtkSlicerDynamicModelerTool
+{
+public:
+  static vtkSlicerDynamicModelerDecimateTool* New();
+  vtkSlicerDynamicModelerTool* CreateToolInstance() override;
+  vtkTypeMacro(vtkSlicerDynamicModelerDecimateTool, vtkSlicerDynamicModelerTool);
+
+  /// Human-readable name of the mesh modification tool
+  const char* GetName() override;
+
+  /// Run the decimation algorithm on the input model node
+  bool RunInternal(vtkMRMLDynamicModelerNode* surfaceEditorNode) override;
+
+protected:
+  vtkSlicerDynamicModelerDecimateTool();
+  ~vtkSlicerDynamicModelerDecimateTool() override;
+  void operator=(const vtkSlicerDynamicModelerDecimateTool&);
+
+protected:
+  vtkSmartPointer<vtkTransformPolyDataFilter>     InputModelToWorldTransformFilter;
+  vtkSmartPointer<vtkGeneralTransform>            InputModelNodeToWorldTransform;
+
+  vtkSmartPointer<vtkFastQuadricDecimation>       DecimationFilter;
+
+  vtkSmartPointer<vtkTransformPolyDataFilter>     OutputModelToWorldTransformFilter;
+  vtkSmartPointer<vtkGeneralTransform>            OutputWorldToModelTransform;
+
+private:
+  vtkSlicerDynamicModelerDecimateTool(const vtkSlicerDynamicModelerDecimateTool&) = delete;
+};
+
+#endif // __vtkSlicerDynamicModelerDecimateTool_h
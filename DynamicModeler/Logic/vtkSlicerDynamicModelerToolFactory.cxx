@@ -22,6 +22,7 @@ limitations under the License.
 #include "vtkSlicerDynamicModelerAppendTool.h"
 #include "vtkSlicerDynamicModelerBoundaryCutTool.h"
 #include "vtkSlicerDynamicModelerCurveCutTool.h"
+#include "vtkSlicerDynamicModelerDecimateTool.h"
 #include "vtkSlicerDynamicModelerExtrudeTool.h"
 #include "vtkSlicerDynamicModelerRevolveTool.h"
 #include "vtkSlicerDynamicModelerHollowTool.h"
@@ -137,6 +138,7 @@ void vtkSlicerDynamicModelerToolFactory::classInitialize()
   vtkSlicerDynamicModelerToolFactoryInstance->RegisterDynamicModelerTool(vtkSmartPointer<vtkSlicerDynamicModelerAppendTool>::New());
   vtkSlicerDynamicModelerToolFactoryInstance->RegisterDynamicModelerTool(vtkSmartPointer<vtkSlicerDynamicModelerROICutTool>::New());
   vtkSlicerDynamicModelerToolFactoryInstance->RegisterDynamicModelerTool(vtkSmartPointer<vtkSlicerDynamicModelerSelectByPointsTool>::New());
+  vtkSlicerDynamicModelerToolFactoryInstance->RegisterDynamicModelerTool(vtkSmartPointer<vtkSlicerDynamicModelerDecimateTool>::New());
 }
 
 //----------------------------------------------------------------------------
@@ -32,6 +32,7 @@
 #include "vtkSlicerDynamicModelerAppendTool.h"
 #include "vtkSlicerDynamicModelerBoundaryCutTool.h"
 #include "vtkSlicerDynamicModelerCurveCutTool.h"
+#include "vtkSlicerDynamicModelerDecimateTool.h"
 #include "vtkSlicerDynamicModelerExtrudeTool.h"
 #include "vtkSlicerDynamicModelerRevolveTool.h"
 #include "vtkSlicerDynamicModelerHollowTool.h"
@@ -284,6 +285,12 @@ QIcon qSlicerSubjectHierarchyDynamicModelerPlugin::icon(vtkIdType itemID)
       return QIcon(":Icons/SelectByPoints.png");
     }
 
+  vtkNew<vtkSlicerDynamicModelerDecimateTool> decimateTool;
+  if (strcmp(associatedNode->GetToolName(), decimateTool->GetName()) == 0)
+    {
+      return QIcon(":Icons/Decimate.png");
+    }
+
   return QIcon();
 }
 
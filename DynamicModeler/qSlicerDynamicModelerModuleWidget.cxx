@@ -48,6 +48,7 @@
 #include <vtkSlicerDynamicModelerAppendTool.h>
 #include <vtkSlicerDynamicModelerBoundaryCutTool.h>
 #include <vtkSlicerDynamicModelerCurveCutTool.h>
+#include <vtkSlicerDynamicModelerDecimateTool.h>
 #include <vtkSlicerDynamicModelerExtrudeTool.h>
 #include <vtkSlicerDynamicModelerRevolveTool.h>
 #include <vtkSlicerDynamicModelerHollowTool.h>
@@ -162,6 +163,10 @@ void qSlicerDynamicModelerModuleWidget::setup()
   this->addToolButton(QIcon(":/Icons/SelectByPoints.png"), selectByPointsTool, buttonPosition / columns, buttonPosition % columns);
   buttonPosition++;
 
+  vtkNew<vtkSlicerDynamicModelerDecimateTool> decimateTool;
+  this->addToolButton(QIcon(":/Icons/Decimate.png"), decimateTool, buttonPosition / columns, buttonPosition % columns);
+  buttonPosition++;
+
   connect(d->SubjectHierarchyTreeView, SIGNAL(currentItemChanged(vtkIdType)),
     this, SLOT(onParameterNodeChanged()));
   connect(d->ApplyButton, SIGNAL(checkStateChanged(Qt::CheckState)),
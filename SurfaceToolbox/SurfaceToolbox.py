@@ -18,7 +18,7 @@ class SurfaceToolbox(ScriptedLoadableModule):
     ScriptedLoadableModule.__init__(self, parent)
     self.parent.title = "Surface Toolbox"
     self.parent.categories = ["Surface Models"]
-    self.parent.dependencies = []
+    self.parent.dependencies = ["DynamicModeler"]
     self.parent.contributors = [
       "Luca Antiga (Orobix), Ron Kikinis (Brigham and Women's Hospital), Ben Wilson (Kitware)"]
     self.parent.helpText = """
@@ -429,21 +429,19 @@ class SurfaceToolboxLogic(ScriptedLoadableModuleLogic):
 
     :param reductionFactor: Target reduction factor during decimation. Ratio of triangles that are requested to
       be eliminated. 0.8 means that the mesh size is requested to be reduced by 80%.
-    :param decimateBoundary: If enabled then 'FastQuadric' method is used (it provides more even element sizes but cannot
-      be forced to preserve boundary), otherwise 'DecimatePro' method is used (that can preserve boundary edges but tend
-      to create more ill-shaped triangles).
-    :param lossless: Lossless remeshing for FastQuadric method. The flag has no effect if other method is used.
-    :param aggressiveness: Balances between accuracy and computation time for FastQuadric method (default = 7.0). The flag has no effect if other method is used.
-    """
-    parameters = {
-      "inputModel": inputModel,
-      "outputModel": outputModel,
-      "reductionFactor": reductionFactor,
-      "method": "FastQuadric" if decimateBoundary else "DecimatePro",
-      "boundaryDeletion": decimateBoundary
-      }
-    cliNode = slicer.cli.runSync(slicer.modules.decimation, None, parameters)
-    slicer.mrmlScene.RemoveNode(cliNode)
+    :param decimateBoundary: If disabled then boundary vertices of open surfaces are not moved or removed.
+    :param lossless: Lossless remeshing, the reduction factor is ignored.
+    :param aggressiveness: Balances between accuracy and computation time (default = 7.0).
+    """
+    # Decimation runs in-process, the mesh is not written to and read back from a temporary file
+    decimation = slicer.vtkFastQuadricDecimation()
+    decimation.SetBoundaryVertexDeletion(decimateBoundary)
+    decimation.SetLossless(lossless)
+    decimation.SetAggressiveness(aggressiveness)
+    decimation.SetTargetReduction(reductionFactor)
+    decimation.SetInputData(inputModel.GetPolyData())
+    decimation.Update()
+    outputModel.SetAndObservePolyData(decimation.GetOutput())
 
   @staticmethod
   def smooth(inputModel, outputModel, method='Taubin', iterations=30, laplaceRelaxationFactor=0.5, taubinPassBand=0.1, boundarySmoothing=True):